@@ -3,11 +3,15 @@
 
 #include "Util.hpp"
 #include "Interpolate.hpp"
+#include "Resample.hpp"
+#include "Pyramid.hpp"
+#include "Shear.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <cmath>
-
-enum InterpolateType {BILINEAR = 3, AVERAGE = 2, NEIGHBOR = 1};
+#include <cfloat>
+#include <vector>
+#include <algorithm>
 
 namespace AffineTransform
 {
@@ -36,32 +40,69 @@ namespace AffineTransform
         return (cv::Mat_<double>(3,3) << 1, hy, 0, 0, 1, 0, 0, 0, 1);
     }
 
-    // -Compute inverse transform Ti = inverse(T)
-    // -iterate through each location (xdest,ydest) in the destination image
-    //         and create a column vector (cv::Mat) D = [xdest;ydest;1]
-    //     -compute source location vector which is used to determine where
-    //             to sample from in the source image S = Ti * D
+    // -projective transform taking the four points src[k] to dst[k]
+    //     -fix h33 = 1 and solve the 8x8 system given by
+    //             x' = (h11 x + h12 y + h13) / (h31 x + h32 y + 1)
+    //             y' = (h21 x + h22 y + h23) / (h31 x + h32 y + 1)
+    //     -three collinear or two repeated points make the system singular
+    //             and fail the assertion
+    inline cv::Mat Homography(const std::vector<cv::Point2d> &src, const std::vector<cv::Point2d> &dst)
+    {
+        CV_Assert(src.size() == 4 && dst.size() == 4);
+        cv::Mat A(8, 8, CV_64F, cv::Scalar(0.0));
+        cv::Mat b(8, 1, CV_64F);
+        for( int k=0; k<4; k++ )
+        {
+            double x = src[k].x, y = src[k].y;
+            double u = dst[k].x, v = dst[k].y;
+            double *r0 = A.ptr<double>(2*k);
+            double *r1 = A.ptr<double>(2*k + 1);
+            r0[0] = x; r0[1] = y; r0[2] = 1; r0[6] = -u*x; r0[7] = -u*y;
+            r1[3] = x; r1[4] = y; r1[5] = 1; r1[6] = -v*x; r1[7] = -v*y;
+            b.at<double>(2*k, 0) = u;
+            b.at<double>(2*k + 1, 0) = v;
+        }
+
+        cv::Mat h;
+        CV_Assert(cv::solve(A, b, h, cv::DECOMP_LU));
+        return (cv::Mat_<double>(3,3) << h.at<double>(0,0), h.at<double>(1,0), h.at<double>(2,0),
+                                         h.at<double>(3,0), h.at<double>(4,0), h.at<double>(5,0),
+                                         h.at<double>(6,0), h.at<double>(7,0), 1);
+    }
+
+    // -map each location (xdest,ydest) of region in the destination image
+    //         through the inverse transform Ti (row-major 3x3 doubles)
     //     -normalize the souce vector S = S * 1/S(3)
     //     -sample src image at location xsrc = S(1), ysrc = S(2) and put
     //             value in dest location
+    // -the source vector is a header over a stack buffer so no Mat is
+    //         allocated per pixel
     template< typename T >
-    void Transform(cv::Mat &source, const cv::Mat &transform, int xsize, int ysize, InterpolateType type)
+    void TransformRegion(cv::Mat &source, cv::Mat &dest, const double *ti, const cv::Rect &region, InterpolateType type)
     {
-        cv::Mat dest(xsize, ysize, source.type());
+        double s[3];
+        cv::Mat tv(3, 1, CV_64F, s);
 
-        for( int i=0; i<xsize; i++ )
-            for( int j=0; j<ysize; j++ )
+        for( int i=region.y; i<region.y + region.height; i++ )
+            for( int j=region.x; j<region.x + region.width; j++ )
             {
-                cv::Vec<double, 3> v(j, i, 1.0);
-                cv::Mat tv(v);
+                s[0] = ti[0]*j + ti[1]*i + ti[2];
+                s[1] = ti[3]*j + ti[4]*i + ti[5];
+                s[2] = ti[6]*j + ti[7]*i + ti[8];
 
-                tv = transform.inv() * tv;   
-                tv = tv * (1.0 / tv.at<double>(2,0));                        
-                if( !Util::isPoint<T>(tv) )
+                double w = 1.0 / s[2];
+                s[0] *= w;
+                s[1] *= w;
+                s[2] *= w;
+
+                int x = (int)s[0];
+                int y = (int)s[1];
+                if( !Util::isPoint<T>(tv) || x < 0 || x >= source.cols || y < 0 || y >= source.rows )
                 {
                     switch(type)
                     {
                         case(BILINEAR):
+                        default:
                             dest.at<T>(i, j) = Interpolate::Bilinear<T>(source, tv);
                             break;
                         case(AVERAGE):
@@ -74,14 +115,427 @@ namespace AffineTransform
                 }
                 else
                 {
-                    dest.at<T>(i, j) = source.at<T>((int)tv.at<double>(1, 0), (int)tv.at<double>(0,0));
+                    dest.at<T>(i, j) = source.at<T>(y, x);
                 }
             }
+    }
+
+    // -inverse of the 3x3 CV_64F transform into ti (row major) from its
+    //         adjugate, no Mat is allocated
+    inline void Inverse(const cv::Mat &transform, double *ti)
+    {
+        CV_Assert(transform.rows == 3 && transform.cols == 3 && transform.type() == CV_64F);
+        double t[9];
+        for( int k=0; k<9; k++ )
+            t[k] = transform.at<double>(k/3, k%3);
+
+        ti[0] = t[4]*t[8] - t[5]*t[7];
+        ti[1] = t[2]*t[7] - t[1]*t[8];
+        ti[2] = t[1]*t[5] - t[2]*t[4];
+        ti[3] = t[5]*t[6] - t[3]*t[8];
+        ti[4] = t[0]*t[8] - t[2]*t[6];
+        ti[5] = t[2]*t[3] - t[0]*t[5];
+        ti[6] = t[3]*t[7] - t[4]*t[6];
+        ti[7] = t[1]*t[6] - t[0]*t[7];
+        ti[8] = t[0]*t[4] - t[1]*t[3];
+
+        double det = t[0]*ti[0] + t[1]*ti[3] + t[2]*ti[6];
+        double scale = det != 0.0 ? 1.0 / det : 0.0;
+        for( int k=0; k<9; k++ )
+            ti[k] *= scale;
+    }
+
+    // -Compute inverse transform Ti = inverse(T)
+    // -iterate through each location (xdest,ydest) in the destination image
+    //         and create a column vector (cv::Mat) D = [xdest;ydest;1]
+    //     -compute source location vector which is used to determine where
+    //             to sample from in the source image S = Ti * D
+    //     -normalize the souce vector S = S * 1/S(3)
+    //     -sample src image at location xsrc = S(1), ysrc = S(2) and put
+    //             value in dest location
+    template< typename T >
+    void Transform(cv::Mat &source, const cv::Mat &transform, int xsize, int ysize, InterpolateType type)
+    {
+        cv::Mat dest(xsize, ysize, source.type());
+
+        double ti[9];
+        Inverse(transform, ti);
+        TransformRegion<T>(source, dest, ti, cv::Rect(0, 0, dest.cols, dest.rows), type);
         
         source = dest.clone();
     }
 
+    // -bounding box in the source of a destination rectangle, found by
+    //         mapping its four corners through Ti and padding by one pixel
+    //         for the interpolation neighbourhood
+    inline cv::Rect SourceBounds(const double *ti, const cv::Rect &region, const cv::Size &size)
+    {
+        double xmin = DBL_MAX, ymin = DBL_MAX;
+        double xmax = -DBL_MAX, ymax = -DBL_MAX;
+        for( int k=0; k<4; k++ )
+        {
+            double j = region.x + ((k & 1) ? region.width : 0);
+            double i = region.y + ((k & 2) ? region.height : 0);
+            double w = 1.0 / (ti[6]*j + ti[7]*i + ti[8]);
+            double x = (ti[0]*j + ti[1]*i + ti[2]) * w;
+            double y = (ti[3]*j + ti[4]*i + ti[5]) * w;
+            xmin = std::min(xmin, x);
+            xmax = std::max(xmax, x);
+            ymin = std::min(ymin, y);
+            ymax = std::max(ymax, y);
+        }
+        int x0 = std::max(0, (int)floor(xmin) - 1);
+        int y0 = std::max(0, (int)floor(ymin) - 1);
+        int x1 = std::min(size.width, (int)ceil(xmax) + 2);
+        int y1 = std::min(size.height, (int)ceil(ymax) + 2);
+        return cv::Rect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+    }
+
+    struct Tile
+    {
+        cv::Rect dest;
+        cv::Rect src;
+    };
+
+    inline bool SourceOrder(const Tile &a, const Tile &b)
+    {
+        if( a.src.y != b.src.y )
+            return a.src.y < b.src.y;
+        return a.src.x < b.src.x;
+    }
+
+    template< typename T >
+    class TransformBody : public cv::ParallelLoopBody
+    {
+     public:
+        TransformBody(cv::Mat &source, cv::Mat &dest, const double *ti, const Tile *tiles, InterpolateType type)
+            : source(source), dest(dest), ti(ti), tiles(tiles), type(type) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            for( int k=range.start; k<range.end; k++ )
+                TransformRegion<T>(source, dest, ti, tiles[k].dest, type);
+        }
+
+     private:
+        cv::Mat &source;
+        cv::Mat &dest;
+        const double *ti;
+        const Tile *tiles;
+        InterpolateType type;
+    };
+
+    // -split the destination into square tiles, halving the tile size
+    //         until the source bounding box of every tile fits in cacheSize
+    //         bytes (counted in whole cache lines per source row)
+    // -order tiles by the top-left of their source bounding box so that
+    //         consecutive tiles stream through neighbouring source rows
+    // -hand contiguous runs of tiles to the thread pool; every pixel is
+    //         produced by TransformRegion so the output matches Transform
+    // -with a pool the result and the tile list come from it, and a source
+    //         that came from it goes back to it
+    template< typename T >
+    void TransformTiled(cv::Mat &source, const cv::Mat &transform, int xsize, int ysize, InterpolateType type, size_t cacheSize = 256*1024, Pool *pool = NULL)
+    {
+        cv::Mat dest = Buffer::Acquire(pool, xsize, ysize, source.type());
+
+        double ti[9];
+        Inverse(transform, ti);
+
+        cv::Mat buffer;
+        Tile *tiles = NULL;
+        int count = 0;
+        for( int size=128; size>=8; size/=2 )
+        {
+            Buffer::Release(pool, buffer);
+            buffer = Buffer::Acquire(pool, 1, (int)(((dest.rows + size - 1) / size) * ((dest.cols + size - 1) / size) * sizeof(Tile)), CV_8U);
+            tiles = (Tile*)buffer.data;
+            count = 0;
+            size_t worst = 0;
+            for( int i=0; i<dest.rows; i+=size )
+                for( int j=0; j<dest.cols; j+=size )
+                {
+                    Tile &tile = tiles[count++];
+                    tile.dest = cv::Rect(j, i, std::min(size, dest.cols - j), std::min(size, dest.rows - i));
+                    tile.src = SourceBounds(ti, tile.dest, source.size());
+                    size_t bytes = tile.src.height * (((size_t)tile.src.width * source.elemSize() + 63) & ~(size_t)63);
+                    worst = std::max(worst, bytes);
+                }
+            if( worst <= cacheSize )
+                break;
+        }
+
+        std::sort(tiles, tiles + count, SourceOrder);
+        cv::parallel_for_(cv::Range(0, count), TransformBody<T>(source, dest, ti, tiles, type), cv::getNumThreads() * 4);
+
+        Buffer::Release(pool, buffer);
+        Buffer::Release(pool, source);
+        source = dest;
+    }
+
+    // -source pixels covered by one destination pixel: the longer of the
+    //         two columns of the inverse Jacobian (constant for affine Ti)
+    inline double Footprint(const double *ti)
+    {
+        return std::max(sqrt(ti[0]*ti[0] + ti[3]*ti[3]), sqrt(ti[1]*ti[1] + ti[4]*ti[4]));
+    }
 
+    template< typename T >
+    class PyramidBody : public cv::ParallelLoopBody
+    {
+     public:
+        PyramidBody(Pyramid<T> &pyramid, cv::Mat &dest, const double *ti, double level, InterpolateType type)
+            : pyramid(pyramid), dest(dest), ti(ti), level(level), type(type),
+              rows(pyramid.levels[0].rows), cols(pyramid.levels[0].cols) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            const int cn = dest.channels();
+            for( int i=range.start; i<range.end; i++ )
+            {
+                C *d = dest.ptr<C>(i);
+                for( int j=0; j<dest.cols; j++ )
+                {
+                    double w = 1.0 / (ti[6]*j + ti[7]*i + ti[8]);
+                    double x = (ti[0]*j + ti[1]*i + ti[2]) * w;
+                    double y = (ti[3]*j + ti[4]*i + ti[5]) * w;
+                    bool inside = x >= -0.5 && y >= -0.5 && x < cols - 0.5 && y < rows - 0.5;
+                    for( int k=0; k<cn; k++ )
+                        d[j*cn + k] = inside ? cv::saturate_cast<C>(pyramid.Sample(x, y, level, type, k)) : 0;
+                }
+            }
+        }
+
+     private:
+        Pyramid<T> &pyramid;
+        cv::Mat &dest;
+        const double *ti;
+        double level;
+        InterpolateType type;
+        int rows, cols;
+    };
+
+    // -warp from a pyramid instead of the full resolution source
+    //     -pick the level matching the footprint of a destination pixel
+    //     -NEIGHBOR reads the nearest level, other types blend the two
+    //             levels around the footprint when trilinear is set and
+    //             read the finer one otherwise
+    //     -locations outside the source are black as in Transform
+    //     -levels are reduced before the rows are split across threads
+    //             so the pyramid can be reused for many output scales
+    //     -the result comes from pool when one is given
+    template< typename T >
+    cv::Mat TransformPyramid(Pyramid<T> &pyramid, const cv::Mat &transform, int xsize, int ysize, InterpolateType type, bool trilinear = true, Pool *pool = NULL)
+    {
+        cv::Mat dest = Buffer::Acquire(pool, xsize, ysize, pyramid.levels[0].type());
+
+        double ti[9];
+        Inverse(transform, ti);
+        double level = pyramid.LevelFor(Footprint(ti));
+        if( !trilinear && type != NEIGHBOR )
+            level = floor(level);
+        pyramid.Level((int)ceil(level));
+
+        cv::parallel_for_(cv::Range(0, dest.rows), PyramidBody<T>(pyramid, dest, ti, level, type));
+        return dest;
+    }
+
+    template< typename T >
+    class PerspectiveBody : public cv::ParallelLoopBody
+    {
+     public:
+        PerspectiveBody(const cv::Mat &source, cv::Mat &dest, const double *ti, InterpolateType type, double tolerance, int span)
+            : source(source), dest(dest), ti(ti), type(type), tolerance(tolerance), span(span) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            const int cn = dest.channels();
+
+            // span lengths span >> k with the steps of X, Y and W over them
+            //         and their reciprocals, the same for every row
+            int size[32];
+            double sx[32], sy[32], sw[32], inv[32];
+            int levels = 0;
+            for( int n=span; n>0; n/=2, levels++ )
+            {
+                size[levels] = n;
+                sx[levels] = ti[0]*n;
+                sy[levels] = ti[3]*n;
+                sw[levels] = ti[6]*n;
+                inv[levels] = 1.0 / n;
+            }
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                // numerator and denominator at the start of the span
+                double X = ti[1]*i + ti[2];
+                double Y = ti[4]*i + ti[5];
+                double W = ti[7]*i + ti[8];
+                C *d = dest.ptr<C>(i);
+
+                int j = 0;
+                double ua = X / W, va = Y / W;
+                while( j < dest.cols )
+                {
+                    int k = 0;
+                    while( j + size[k] > dest.cols )
+                        k++;
+                    double wb, ub, vb;
+                    for( ;; )
+                    {
+                        wb = W + sw[k];
+                        ub = (X + sx[k]) / wb;
+                        vb = (Y + sy[k]) / wb;
+                        if( k == levels - 1 )
+                            break;
+                        double wm = W + sw[k + 1];
+                        double h = size[k + 1] * inv[k];
+                        double du = (X + sx[k + 1]) / wm - (ua + (ub - ua)*h);
+                        double dv = (Y + sy[k + 1]) / wm - (va + (vb - va)*h);
+                        if( W > 0 && wb > 0 && fabs(du) <= tolerance && fabs(dv) <= tolerance )
+                            break;
+                        k++;
+                    }
+
+                    // spans reaching behind the projection plane are cut to
+                    //         single pixels, which are left black
+                    const int n = size[k];
+                    double du = (ub - ua) * inv[k];
+                    double dv = (vb - va) * inv[k];
+                    double u = ua, v = va;
+                    for( int p=0; p<n; p++ )
+                    {
+                        for( int q=0; q<cn; q++ )
+                            d[(j + p)*cn + q] = W > 0 ? cv::saturate_cast<C>(Interpolate::Sample<T>(source, u, v, type, q)) : C(0);
+                        u += du;
+                        v += dv;
+                    }
+
+                    j += n;
+                    X += sx[k];
+                    Y += sy[k];
+                    W = wb;
+                    ua = ub;
+                    va = vb;
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        cv::Mat &dest;
+        const double *ti;
+        InterpolateType type;
+        double tolerance;
+        int span;
+    };
+
+    // -warp through a full 3x3 homography
+    //     -along each destination row the numerator and denominator of Ti * D
+    //             are linear in x, so they are stepped from span end to
+    //             span end by additions instead of multiplied
+    //     -the division is only done at the ends of spans of span >> k
+    //             pixels and the source location is stepped linearly in
+    //             between, as in span-based perspective texture mapping
+    //     -a span is halved while its exact midpoint is further than
+    //             tolerance source pixels from the interpolated one, and
+    //             near the end of a row until it fits
+    //     -rows are split across threads
+    //     -with a pool the result comes from it and a source that came from
+    //             it goes back to it
+    template< typename T >
+    void TransformPerspective(cv::Mat &source, const cv::Mat &transform, int xsize, int ysize, InterpolateType type, double tolerance = 0.1, int span = 16, Pool *pool = NULL)
+    {
+        CV_Assert(span >= 1);
+        cv::Mat dest = Buffer::Acquire(pool, xsize, ysize, source.type());
+
+        double ti[9];
+        Inverse(transform, ti);
+        cv::parallel_for_(cv::Range(0, dest.rows), PerspectiveBody<T>(source, dest, ti, type, tolerance, span));
+
+        Buffer::Release(pool, source);
+        source = dest;
+    }
+
+    // -true when the transform is a scale plus translate with no rotation,
+    //         shear or projective terms
+    inline bool isScale(const cv::Mat &transform)
+    {
+        const double eps = 1e-12;
+        return fabs(transform.at<double>(0,1)) < eps && fabs(transform.at<double>(1,0)) < eps &&
+               fabs(transform.at<double>(2,0)) < eps && fabs(transform.at<double>(2,1)) < eps &&
+               fabs(transform.at<double>(2,2) - 1.0) < eps &&
+               fabs(transform.at<double>(0,0)) > eps && fabs(transform.at<double>(1,1)) > eps;
+    }
+
+    // -true when the transform has no projective terms (any linear map plus
+    //         translate)
+    inline bool isAffine(const cv::Mat &transform)
+    {
+        const double eps = 1e-12;
+        return fabs(transform.at<double>(2,0)) < eps && fabs(transform.at<double>(2,1)) < eps &&
+               fabs(transform.at<double>(2,2) - 1.0) < eps;
+    }
+
+    inline bool isRotation(const cv::Mat &transform)
+    {
+        const double eps = 1e-9;
+        double c0 = transform.at<double>(0,0);
+        double s0 = transform.at<double>(1,0);
+        return fabs(transform.at<double>(2,0)) < eps && fabs(transform.at<double>(2,1)) < eps &&
+               fabs(transform.at<double>(2,2) - 1.0) < eps &&
+               fabs(c0 - transform.at<double>(1,1)) < eps && fabs(s0 + transform.at<double>(0,1)) < eps &&
+               fabs(c0*c0 + s0*s0 - 1.0) < eps;
+    }
+
+    // -route scale-only transforms to the separable resampler,
+    //         rotations of large images to the three-pass shear,
+    //         reductions of 4x or more to a trilinear pyramid warp,
+    //         homographies to the span-based perspective warp and
+    //         everything else to the tiled warp
+    //     -the warp has no BICUBIC or LANCZOS3 kernel and uses BILINEAR
+    //     -with a pool the result, the pyramid levels and the scratch of
+    //             the resampler and shear come from it, and a source that
+    //             came from it goes back to it, so warping pooled frames
+    //             in place recycles the same blocks
+    template< typename T >
+    void Warp(cv::Mat &source, const cv::Mat &transform, int xsize, int ysize, InterpolateType type, Pool *pool = NULL)
+    {
+        if( !isAffine(transform) )
+        {
+            TransformPerspective<T>(source, transform, xsize, ysize, type, 0.1, 16, pool);
+            return;
+        }
+
+        double ti[9];
+        Inverse(transform, ti);
+        cv::Mat dest;
+        if( isScale(transform) )
+        {
+            dest = Buffer::Acquire(pool, xsize, ysize, source.type());
+            Resample::Resize<T>(source, dest, ti[0], ti[2], ti[4], ti[5], type, pool);
+        }
+        else if( isRotation(transform) && (int)source.total() >= Shear::MinPixels )
+        {
+            dest = Buffer::Acquire(pool, xsize, ysize, source.type());
+            Shear::Rotate<T>(source, dest, ti, type, pool);
+        }
+        else if( Footprint(ti) >= 4.0 )
+        {
+            Pyramid<T> pyramid(source, REDUCE5TAP, pool);
+            dest = TransformPyramid<T>(pyramid, transform, xsize, ysize, type == NEIGHBOR ? NEIGHBOR : BILINEAR, true, pool);
+        }
+        else
+        {
+            TransformTiled<T>(source, transform, xsize, ysize, type > BILINEAR ? BILINEAR : type, 256*1024, pool);
+            return;
+        }
+
+        Buffer::Release(pool, source);
+        source = dest;
+    }
 }
 
 #endif
@@ -6,8 +6,13 @@
 #include <opencv2/opencv.hpp>
 #include <math.h>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <cstdio>
 
-#define c 5.0
 #define SWAP(a,b) tempr=(a);(a)=(b);(b)=tempr
 
 /* (C) Copr. 1986-92 Numerical Recipes Software 0#Y". */
@@ -61,8 +66,10 @@ namespace FFT
     }
 
 
+    // -the line buffer and the returned transform come from pool when one
+    //         is given, give the result back with pool->Release once done
     template< typename T>
-    cv::Mat FFT2D(cv::Mat source, int isign, bool shift = true)
+    cv::Mat FFT2D(cv::Mat source, int isign, bool shift = true, Pool *pool = NULL)
     {
         // Require power of 2
         int height = std::pow(2, std::ceil(log(source.rows)/log(2)));
@@ -72,9 +79,9 @@ namespace FFT
         std::cout << "Height : " << height << std::endl;
         std::cout << "Width  : " << width << std::endl;
         std::cout << "Channels : " << source.channels() << std::endl;
-        cv::Mat dest(height, width, CV_64FC2);
+        cv::Mat dest = Buffer::Acquire(pool, height, width, CV_64FC2);
         if ( height != source.rows || width != source.cols )
-            Util::PadImage<T>(dest, source, width, height);
+            dest.setTo(cv::Scalar(0.0, 0.0));
         
         for ( int i = 0; i < source.rows; ++i )
             for ( int j = 0; j < source.cols; ++j )
@@ -94,7 +101,8 @@ namespace FFT
         }
         
         // Construct arrays of image rows
-        double* data = new double[std::max(width,height)*2];
+        cv::Mat line = Buffer::Acquire(pool, 1, std::max(width,height)*2, CV_64F);
+        double* data = line.ptr<double>(0);
         for ( int i = 0; i < dest.rows; i++ )
         {
             for ( int j = 0; j < dest.cols; j++ )
@@ -112,7 +120,15 @@ namespace FFT
             }
         }    
         if ( isign < 0 )
-            dest = dest * 1.0/(dest.rows*dest.cols);
+        {
+            double scale = 1.0/(dest.rows*dest.cols);
+            for ( int i = 0; i < dest.rows; ++i )
+                for ( int j = 0; j < dest.cols; ++j )
+                {
+                    dest.at<Vec2d>(i,j)[0] *= scale;
+                    dest.at<Vec2d>(i,j)[1] *= scale;
+                }
+        }
  
         // Construct arrays of image cols
         for ( int j = 0; j < dest.cols; j++ )
@@ -146,9 +162,670 @@ namespace FFT
                     }
         }
 
-        delete [] data;
+        Buffer::Release(pool, line);
         return dest;
     }
+
+
+    // -multiply by (-1)^(i+j), in the spatial domain this moves the zero
+    //         frequency of the transform to the centre
+    inline void Shift(Spectrum &spectrum)
+    {
+        for( int i=0; i<spectrum.rows; i++ )
+        {
+            double *a = spectrum.re.ptr<double>(i);
+            double *b = spectrum.im.ptr<double>(i);
+            for( int j=(i & 1) ^ 1; j<spectrum.cols; j+=2 )
+            {
+                a[j] = -a[j];
+                b[j] = -b[j];
+            }
+        }
+    }
+
+    // -smallest power of 2 >= n
+    inline int Pow2(int n)
+    {
+        int p = 1;
+        while( p < n )
+            p <<= 1;
+        return p;
+    }
+
+    // -length n transform of data (interleaved re, im) whose entries from
+    //         m on are zero, m a power of 2 dividing n
+    //     -with L = n / m, X[L q + p] = sum_k (x[k] W^(k p)) W_m^(k q), so L
+    //             m-point transforms of twiddled inputs replace the n-point
+    //             one: n log2 m butterflies instead of n log2 n
+    //     -table holds the n twiddles W^k = e^(isign 2 pi i k / n), input
+    //             and work 2 m doubles each
+    inline void PrunedFFT1D(double *data, int n, int m, int isign, const double *table, double *input, double *work)
+    {
+        if( m >= n )
+        {
+            FFT1D( data - 1, n, isign );
+            return;
+        }
+
+        const int L = n / m;
+        std::copy(data, data + 2*m, input);
+        for( int p=0; p<L; p++ )
+        {
+            for( int k=0; k<m; k++ )
+            {
+                int t = (k * p) & (n - 1);
+                double wr = table[2*t], wi = table[2*t + 1];
+                work[2*k] = input[2*k]*wr - input[2*k + 1]*wi;
+                work[2*k + 1] = input[2*k]*wi + input[2*k + 1]*wr;
+            }
+
+            FFT1D( work - 1, m, isign );
+
+            for( int q=0; q<m; q++ )
+            {
+                data[2*(L*q + p)] = work[2*q];
+                data[2*(L*q + p) + 1] = work[2*q + 1];
+            }
+        }
+    }
+
+    // -1D transforms of the rows (or columns) of a Spectrum, one line per
+    //         index of range gathered from the two planes into a local
+    //         buffer and scattered back scaled by scale
+    //     -only the first extent entries of a line may be non zero, lines
+    //             are transformed with the input pruned FFT when extent is
+    //             at most half their length, table then holds its twiddles
+    //     -the line buffer and the pruned transform scratch are one block
+    //             per call, from pool when given
+    class LineBody : public cv::ParallelLoopBody
+    {
+     public:
+        LineBody(Spectrum &spectrum, bool columns, int isign, double scale, int extent, const double *table, Pool *pool)
+            : spectrum(spectrum), columns(columns), isign(isign), scale(scale), extent(extent), table(table), pool(pool) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int n = columns ? spectrum.rows : spectrum.cols;
+            const int m = std::min(Pow2(extent), n);
+            const size_t step = spectrum.re.step / sizeof(double);
+            cv::Mat scratch = Buffer::Acquire(pool, 1, m < n ? 2*n + 4*m : 2*n, CV_64F);
+            double *data = scratch.ptr<double>(0);
+            double *input = data + 2*n;
+            double *work = input + 2*m;
+
+            for( int k=range.start; k<range.end; k++ )
+            {
+                double *a = columns ? spectrum.re.ptr<double>(0) + k : spectrum.re.ptr<double>(k);
+                double *b = columns ? spectrum.im.ptr<double>(0) + k : spectrum.im.ptr<double>(k);
+                const size_t stride = columns ? step : 1;
+                for( int j=0; j<m; j++ )
+                {
+                    data[2*j] = a[j*stride];
+                    data[2*j + 1] = b[j*stride];
+                }
+
+                if( m < n )
+                    PrunedFFT1D( data, n, m, isign, table, input, work );
+                else
+                    FFT::FFT1D( data - 1, n, isign );
+
+                for( int j=0; j<n; j++ )
+                {
+                    a[j*stride] = data[2*j] * scale;
+                    b[j*stride] = data[2*j + 1] * scale;
+                }
+            }
+            Buffer::Release(pool, scratch);
+        }
+
+     private:
+        Spectrum &spectrum;
+        bool columns;
+        int isign;
+        double scale;
+        int extent;
+        const double *table;
+        Pool *pool;
+    };
+
+    inline cv::Mutex& TwiddleLock()
+    {
+        static cv::Mutex lock;
+        return lock;
+    }
+
+    inline std::map<std::pair<int, int>, std::vector<double> >& TwiddleTables()
+    {
+        static std::map<std::pair<int, int>, std::vector<double> > tables;
+        return tables;
+    }
+
+    // -the n twiddles e^(isign 2 pi i k / n) used by PrunedFFT1D
+    //     -built once per length and sign and never dropped, n is a power
+    //             of 2 so there are at most 62 tables, the pointer stays
+    //             valid for the life of the program
+    inline const double* Twiddles(int n, int isign)
+    {
+        cv::AutoLock lock(TwiddleLock());
+        std::vector<double> &table = TwiddleTables()[std::make_pair(n, isign)];
+        if( table.empty() )
+        {
+            table.resize(2*n);
+            for( int t=0; t<n; t++ )
+            {
+                table[2*t] = cos(2.0 * M_PI * t / n);
+                table[2*t + 1] = isign * sin(2.0 * M_PI * t / n);
+            }
+        }
+        return &table[0];
+    }
+
+    // -2D transform of a Spectrum in place, rows then columns
+    //     -isign < 0 is the forward transform and is scaled by 1/(rows*cols)
+    //             as in FFT2D
+    //     -extent, when given, bounds the non zero data to its top left
+    //             corner: rows below it are all zero and stay zero so their
+    //             transforms are skipped, and rows and columns use the
+    //             input pruned FFT
+    //     -one stripe per thread, each taking its line scratch from pool
+    //             when given
+    inline void Transform(Spectrum &spectrum, int isign, cv::Size extent = cv::Size(), Pool *pool = NULL)
+    {
+        int height = extent.height > 0 ? std::min(extent.height, spectrum.rows) : spectrum.rows;
+        int width = extent.width > 0 ? std::min(extent.width, spectrum.cols) : spectrum.cols;
+        double scale = isign < 0 ? 1.0 / ((double)spectrum.rows * spectrum.cols) : 1.0;
+        const double *rowTable = Pow2(width) < spectrum.cols ? Twiddles(spectrum.cols, isign) : NULL;
+        const double *colTable = Pow2(height) < spectrum.rows ? Twiddles(spectrum.rows, isign) : NULL;
+        cv::parallel_for_(cv::Range(0, height), LineBody(spectrum, false, isign, scale, width, rowTable, pool), cv::getNumThreads());
+        cv::parallel_for_(cv::Range(0, spectrum.cols), LineBody(spectrum, true, isign, 1.0, height, colTable, pool), cv::getNumThreads());
+    }
+
+    // -copy an image into the planes of spectrum, channel 0 as the real
+    //         part and channel 1 (if any) as the imaginary part
+    //     -the image sits at the top left and the rest is zero filled
+    //     -shift multiplies by (-1)^(i+j) on the way in
+    template< typename T >
+    void Fill(const cv::Mat &source, Spectrum &spectrum, bool shift)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int cn = source.channels();
+        const int height = spectrum.rows;
+        const int width = spectrum.cols;
+        CV_Assert(source.rows <= height && source.cols <= width);
+
+        spectrum.original = source.size();
+        for( int i=0; i<height; i++ )
+        {
+            double *a = spectrum.re.ptr<double>(i);
+            double *b = spectrum.im.ptr<double>(i);
+            int j = 0;
+            if( i < source.rows )
+            {
+                const C *p = source.ptr<C>(i);
+                double sign = shift && (i & 1) ? -1.0 : 1.0;
+                for( ; j<source.cols; j++ )
+                {
+                    a[j] = sign * p[j*cn];
+                    b[j] = cn > 1 ? sign * p[j*cn + 1] : 0.0;
+                    if( shift )
+                        sign = -sign;
+                }
+            }
+            std::fill(a + j, a + width, 0.0);
+            std::fill(b + j, b + width, 0.0);
+        }
+    }
+
+    // -forward transform of an image into a planar Spectrum
+    //     -the image is filled into a power of 2 sized Spectrum as above,
+    //             its size is kept in original and bounds the pruned
+    //             transform
+    //     -shift centres the zero frequency, the sign flip is applied as
+    //             the planes are filled
+    //     -size, when given, is the least transform size wanted (e.g. the
+    //             image plus kernel size for linear convolution)
+    //     -with a pool the result comes from it, give it back with
+    //             release(pool) once done
+    template< typename T >
+    Spectrum Forward(const cv::Mat &source, bool shift = true, cv::Size size = cv::Size(), Pool *pool = NULL)
+    {
+        int height = Pow2(std::max(source.rows, size.height));
+        int width = Pow2(std::max(source.cols, size.width));
+
+        Spectrum spectrum(height, width, shift, pool);
+        Fill<T>(source, spectrum, shift);
+        Transform(spectrum, -1, source.size(), pool);
+        return spectrum;
+    }
+
+    // -inverse transform into a new Spectrum holding the complex image,
+    //         the centring sign flip is undone when spectrum is shifted
+    //     -with a pool the result comes from it as for Forward
+    inline Spectrum Inverse(const Spectrum &spectrum, Pool *pool = NULL)
+    {
+        Spectrum image = spectrum.clone(pool);
+        Transform(image, 1, cv::Size(), pool);
+        if( spectrum.shifted )
+            Shift(image);
+        image.shifted = false;
+        return image;
+    }
+
+    // -a = a * b, or a * conj(b), element by element one row per index of
+    //         range
+    //     -conjugation is a sign on the imaginary part of b so the inner
+    //             loop has no branch and unit stride on all four planes,
+    //             which lets the compiler vectorize it
+    class MultiplyBody : public cv::ParallelLoopBody
+    {
+     public:
+        MultiplyBody(Spectrum &a, const Spectrum &b, bool conjugate)
+            : a(a), b(b), conjugate(conjugate) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const double sign = conjugate ? -1.0 : 1.0;
+            const int cols = a.cols;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                double *ar = a.re.ptr<double>(i);
+                double *ai = a.im.ptr<double>(i);
+                const double *br = b.re.ptr<double>(i);
+                const double *bi = b.im.ptr<double>(i);
+                for( int j=0; j<cols; j++ )
+                {
+                    double xr = ar[j], xi = ai[j];
+                    double yr = br[j], yi = sign * bi[j];
+                    ar[j] = xr*yr - xi*yi;
+                    ai[j] = xr*yi + xi*yr;
+                }
+            }
+        }
+
+     private:
+        Spectrum &a;
+        const Spectrum &b;
+        bool conjugate;
+    };
+
+    // -complex product of two spectra of the same size, in place in a, with
+    //         conjugate set b is conjugated first (correlation)
+    inline void Multiply(Spectrum &a, const Spectrum &b, bool conjugate = false)
+    {
+        CV_Assert(a.rows == b.rows && a.cols == b.cols);
+        cv::parallel_for_(cv::Range(0, a.rows), MultiplyBody(a, b, conjugate));
+    }
+
+
+    // KernelKey
+    // -everything a kernel spectrum depends on: the kernel contents (by
+    //         hash), its size and precision, the transform size and shift
+    struct KernelKey
+    {
+        unsigned long long hash;
+        int type;
+        int krows, kcols;
+        int rows, cols;
+        bool shifted;
+
+        bool operator<(const KernelKey &k) const
+        {
+            if( hash != k.hash ) return hash < k.hash;
+            if( type != k.type ) return type < k.type;
+            if( krows != k.krows ) return krows < k.krows;
+            if( kcols != k.kcols ) return kcols < k.kcols;
+            if( rows != k.rows ) return rows < k.rows;
+            if( cols != k.cols ) return cols < k.cols;
+            return shifted < k.shifted;
+        }
+    };
+
+    // -64 bit FNV-1a of the kernel elements, row by row so padding
+    //         between rows is ignored
+    inline unsigned long long Hash(const cv::Mat &kernel)
+    {
+        unsigned long long h = 0xcbf29ce484222325ULL;
+        const size_t bytes = kernel.cols * kernel.elemSize();
+        for( int i=0; i<kernel.rows; i++ )
+        {
+            const uchar *p = kernel.ptr<uchar>(i);
+            for( size_t k=0; k<bytes; k++ )
+                h = (h ^ p[k]) * 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    inline cv::Mutex& KernelLock()
+    {
+        static cv::Mutex lock;
+        return lock;
+    }
+
+    inline std::map<KernelKey, Spectrum>& Kernels()
+    {
+        static std::map<KernelKey, Spectrum> kernels;
+        return kernels;
+    }
+
+    // -keys of Kernels oldest first, the oldest spectrum is dropped once
+    //         KernelCapacity are held
+    inline std::deque<KernelKey>& KernelOrder()
+    {
+        static std::deque<KernelKey> order;
+        return order;
+    }
+
+    const size_t KernelCapacity = 32;
+
+    inline std::string KernelFile(const KernelKey &key, const char *directory)
+    {
+        char name[128];
+        snprintf(name, sizeof(name), "/kernel_%016llx_%d_%dx%d_%dx%d_%d.spec",
+                key.hash, key.type, key.krows, key.kcols, key.rows, key.cols, key.shifted ? 1 : 0);
+        return std::string(directory) + name;
+    }
+
+    // -planes of a kernel spectrum as raw doubles, re rows then im rows
+    inline bool SaveKernel(const Spectrum &spectrum, const std::string &file)
+    {
+        std::ofstream out(file.c_str(), std::ios::binary);
+        for( int i=0; out && i<spectrum.rows; i++ )
+            out.write((const char*)spectrum.re.ptr<double>(i), spectrum.cols * sizeof(double));
+        for( int i=0; out && i<spectrum.rows; i++ )
+            out.write((const char*)spectrum.im.ptr<double>(i), spectrum.cols * sizeof(double));
+        return (bool)out;
+    }
+
+    inline bool LoadKernel(Spectrum &spectrum, const std::string &file)
+    {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        for( int i=0; in && i<spectrum.rows; i++ )
+            in.read((char*)spectrum.re.ptr<double>(i), spectrum.cols * sizeof(double));
+        for( int i=0; in && i<spectrum.rows; i++ )
+            in.read((char*)spectrum.im.ptr<double>(i), spectrum.cols * sizeof(double));
+        return (bool)in;
+    }
+
+    // -spectrum of a single channel kernel for rows x cols convolution
+    //     -the kernel centre is moved to the origin, so a product with an
+    //             image spectrum of the same shift has no offset, and the
+    //             spectrum is scaled by rows * cols so the product inverts
+    //             to the plain convolution
+    //     -the kernel is transformed at the top left with the pruned
+    //             transform, a phase ramp then moves its centre
+    inline Spectrum KernelTransform(const cv::Mat &kernel, int rows, int cols, bool shifted = true)
+    {
+        CV_Assert(kernel.channels() == 1 && (kernel.depth() == CV_32F || kernel.depth() == CV_64F));
+        CV_Assert(kernel.rows <= rows && kernel.cols <= cols);
+        Spectrum spectrum(rows, cols, shifted);
+        cv::Mat k;
+        kernel.convertTo(k, CV_64F, (double)rows * cols);
+        Fill<double>(k, spectrum, shifted);
+        Transform(spectrum, -1, k.size());
+
+        const int cy = k.rows / 2, cx = k.cols / 2;
+        for( int i=0; i<rows; i++ )
+        {
+            double *a = spectrum.re.ptr<double>(i);
+            double *b = spectrum.im.ptr<double>(i);
+            double u = i - (shifted ? rows / 2 : 0);
+            for( int j=0; j<cols; j++ )
+            {
+                double v = j - (shifted ? cols / 2 : 0);
+                double phase = 2.0 * M_PI * (u * cy / rows + v * cx / cols);
+                double wr = cos(phase), wi = sin(phase);
+                double xr = a[j], xi = b[j];
+                a[j] = xr*wr - xi*wi;
+                b[j] = xr*wi + xi*wr;
+            }
+        }
+        spectrum.original = kernel.size();
+        return spectrum;
+    }
+
+    // -KernelTransform built once per kernel and size, each call returns
+    //         its own copy so the caller may write to it
+    //     -at most KernelCapacity spectra are kept, the oldest is dropped
+    //             first, ClearKernels drops them all
+    //     -directory, when given, is searched for a saved spectrum before
+    //             one is computed, and new spectra are written there
+    inline Spectrum KernelSpectrum(const cv::Mat &kernel, int rows, int cols, bool shifted = true, const char *directory = NULL)
+    {
+        CV_Assert(kernel.channels() == 1 && (kernel.depth() == CV_32F || kernel.depth() == CV_64F));
+        CV_Assert(kernel.rows <= rows && kernel.cols <= cols);
+        KernelKey key;
+        key.hash = Hash(kernel);
+        key.type = kernel.type();
+        key.krows = kernel.rows;
+        key.kcols = kernel.cols;
+        key.rows = rows;
+        key.cols = cols;
+        key.shifted = shifted;
+
+        cv::AutoLock lock(KernelLock());
+        std::map<KernelKey, Spectrum>::iterator it = Kernels().find(key);
+        if( it != Kernels().end() )
+            return it->second.clone();
+
+        Spectrum spectrum(rows, cols, shifted);
+        spectrum.original = kernel.size();
+        if( !directory || !LoadKernel(spectrum, KernelFile(key, directory)) )
+        {
+            spectrum = KernelTransform(kernel, rows, cols, shifted);
+            if( directory )
+                SaveKernel(spectrum, KernelFile(key, directory));
+        }
+        if( KernelOrder().size() >= KernelCapacity )
+        {
+            Kernels().erase(KernelOrder().front());
+            KernelOrder().pop_front();
+        }
+        Kernels()[key] = spectrum;
+        KernelOrder().push_back(key);
+        return spectrum.clone();
+    }
+
+    inline void ClearKernels()
+    {
+        cv::AutoLock lock(KernelLock());
+        Kernels().clear();
+        KernelOrder().clear();
+    }
+
+    // -linear convolution of channel 0 (and 1 as imaginary part) of source
+    //         with a single channel kernel, zero outside the image
+    //     -one forward transform of the image, a product with the cached
+    //             kernel spectrum and one inverse transform
+    //     -returns the CV_64F real part at the size of source
+    //     -with a pool both spectra come from it, the kernel spectrum is
+    //             still a fresh copy of the cached one
+    template< typename T >
+    cv::Mat Convolve(const cv::Mat &source, const cv::Mat &kernel, const char *directory = NULL, Pool *pool = NULL)
+    {
+        Spectrum spectrum = Forward<T>(source, false, cv::Size(source.cols + kernel.cols - 1, source.rows + kernel.rows - 1), pool);
+        Multiply(spectrum, KernelSpectrum(kernel, spectrum.rows, spectrum.cols, false, directory));
+        Spectrum image = Inverse(spectrum, pool);
+        cv::Mat result = image.re(cv::Rect(0, 0, source.cols, source.rows)).clone();
+        image.release(pool);
+        spectrum.release(pool);
+        return result;
+    }
+
+
+    // Edits class
+    // -sparse changes to a spectrum kept in step with its inverse image
+    // -Set and Scale write the new coefficient into the spectrum and record
+    //         the change, repeated edits of one coefficient are merged
+    // -Apply brings image up to date by adding the sinusoid of every
+    //         recorded change at O(rows*cols) each, or with one full inverse
+    //         transform once there are more than Threshold changes
+    // -image is the whole transform sized complex image, the picture is
+    //         its top left spectrum.original corner
+    class Edits {
+     public:
+        Edits(Spectrum &spectrum);
+        Edits(Spectrum &spectrum, Spectrum &image);
+
+        void Set(int row, int col, double re, double im);
+        void Scale(int row, int col, double h);
+        void Apply();
+        size_t Pending() const;
+        int Threshold() const;
+
+        Spectrum image;
+
+     private:
+        Spectrum spectrum;
+        std::map< std::pair<int, int>, std::pair<double, double> > deltas;
+    };
+
+    // -image += sum over edits e of row[e][i] * col[e][j], one row of the
+    //         image per index of range with every edit applied to it while
+    //         it is in cache
+    class EditBody : public cv::ParallelLoopBody
+    {
+     public:
+        EditBody(Spectrum &image, int edits, const std::vector<double> &rowRe, const std::vector<double> &rowIm,
+                const std::vector<double> &colRe, const std::vector<double> &colIm)
+            : image(image), edits(edits), rowRe(rowRe), rowIm(rowIm), colRe(colRe), colIm(colIm) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int rows = image.rows;
+            const int cols = image.cols;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                double *re = image.re.ptr<double>(i);
+                double *im = image.im.ptr<double>(i);
+                for( int e=0; e<edits; e++ )
+                {
+                    const double ar = rowRe[e*rows + i];
+                    const double ai = rowIm[e*rows + i];
+                    const double *cr = &colRe[e*cols];
+                    const double *ci = &colIm[e*cols];
+                    for( int j=0; j<cols; j++ )
+                    {
+                        re[j] += ar*cr[j] - ai*ci[j];
+                        im[j] += ar*ci[j] + ai*cr[j];
+                    }
+                }
+            }
+        }
+
+     private:
+        Spectrum &image;
+        int edits;
+        const std::vector<double> &rowRe, &rowIm, &colRe, &colIm;
+    };
+
+    // -image from one full inverse of spectrum
+    inline Edits::Edits(Spectrum &spectrum)
+        : image(Inverse(spectrum)), spectrum(spectrum)
+    {
+    }
+
+    // -image already known (e.g. the picture spectrum was made from),
+    //         it is updated in place
+    inline Edits::Edits(Spectrum &spectrum, Spectrum &image)
+        : image(image), spectrum(spectrum)
+    {
+        CV_Assert(image.rows == spectrum.rows && image.cols == spectrum.cols);
+    }
+
+    inline void Edits::Set(int row, int col, double re, double im)
+    {
+        CV_Assert(row >= 0 && row < this->spectrum.rows && col >= 0 && col < this->spectrum.cols);
+        double &a = this->spectrum.re.at<double>(row, col);
+        double &b = this->spectrum.im.at<double>(row, col);
+        std::pair<double, double> &d = this->deltas[std::make_pair(row, col)];
+        d.first += re - a;
+        d.second += im - b;
+        a = re;
+        b = im;
+    }
+
+    inline void Edits::Scale(int row, int col, double h)
+    {
+        Set(row, col, h * this->spectrum.re.at<double>(row, col), h * this->spectrum.im.at<double>(row, col));
+    }
+
+    inline size_t Edits::Pending() const
+    {
+        return this->deltas.size();
+    }
+
+    // -an edit costs about 8 flops per sample, the inverse about 5 per
+    //         sample for each butterfly stage of the rows and columns
+    inline int Edits::Threshold() const
+    {
+        int stages = (int)round(log(this->spectrum.rows)/log(2) + log(this->spectrum.cols)/log(2));
+        return std::max(1, (5*stages + 4) / 8);
+    }
+
+    // -frequency (u, v) of stored sample (row, col) adds
+    //         d e^(2 pi i (u y / rows + v x / cols)) to image(y, x), u and v
+    //         measured from the centre when the spectrum is shifted
+    //     -the exponential splits into a row and a column factor read from
+    //             twiddle tables by (u y) mod rows and (v x) mod cols, the
+    //             tables are built once per call
+    inline void Edits::Apply()
+    {
+        if( this->deltas.empty() )
+            return;
+
+        const int rows = this->spectrum.rows;
+        const int cols = this->spectrum.cols;
+        if( (int)this->deltas.size() > Threshold() )
+        {
+            Spectrum full = Inverse(this->spectrum);
+            full.re.copyTo(this->image.re);
+            full.im.copyTo(this->image.im);
+            this->deltas.clear();
+            return;
+        }
+
+        std::vector<double> yr(rows), yi(rows), xr(cols), xi(cols);
+        for( int k=0; k<rows; k++ )
+        {
+            yr[k] = cos(2.0 * M_PI * k / rows);
+            yi[k] = sin(2.0 * M_PI * k / rows);
+        }
+        for( int k=0; k<cols; k++ )
+        {
+            xr[k] = cos(2.0 * M_PI * k / cols);
+            xi[k] = sin(2.0 * M_PI * k / cols);
+        }
+
+        const int edits = (int)this->deltas.size();
+        std::vector<double> rowRe(edits * rows), rowIm(edits * rows);
+        std::vector<double> colRe(edits * cols), colIm(edits * cols);
+
+        int e = 0;
+        std::map< std::pair<int, int>, std::pair<double, double> >::const_iterator it;
+        for( it=this->deltas.begin(); it!=this->deltas.end(); ++it, e++ )
+        {
+            long long u = it->first.first - (this->spectrum.shifted ? rows / 2 : 0);
+            long long v = it->first.second - (this->spectrum.shifted ? cols / 2 : 0);
+            double dr = it->second.first;
+            double di = it->second.second;
+
+            for( int y=0; y<rows; y++ )
+            {
+                int k = (int)(((u * y) % rows + rows) % rows);
+                rowRe[e*rows + y] = dr*yr[k] - di*yi[k];
+                rowIm[e*rows + y] = dr*yi[k] + di*yr[k];
+            }
+            for( int x=0; x<cols; x++ )
+            {
+                int k = (int)(((v * x) % cols + cols) % cols);
+                colRe[e*cols + x] = xr[k];
+                colIm[e*cols + x] = xi[k];
+            }
+        }
+
+        cv::parallel_for_(cv::Range(0, rows), EditBody(this->image, edits, rowRe, rowIm, colRe, colIm));
+        this->deltas.clear();
+    }
       
   }
 
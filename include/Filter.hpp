@@ -3,11 +3,18 @@
 
 #include "Interpolate.hpp"
 #include "Util.hpp"
+#include "Spectrum.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
 
 enum MasqueType {GAUSSIAN15 = 15, GAUSSIAN7 = 7, SOBEL = 0, PREWITT = 1, LAPLACIAN = 2};
+enum ResponseShape {RESPONSE_IDEAL = 0, RESPONSE_BUTTERWORTH = 1, RESPONSE_GAUSSIAN = 2};
+enum PassType {PASS_LOW = 0, PASS_HIGH = 1, PASS_BAND = 2, PASS_REJECT = 3};
 
 namespace Filter
 {
@@ -29,18 +36,421 @@ namespace Filter
         return dest;
     }
 
+    inline double IntPow(double x, int n)
+    {
+        double r = 1.0;
+        for( ; n>0; n-- )
+            r *= x;
+        return r;
+    }
+
+    // -radial response at squared distance d2 from the zero frequency
+    //     -PASS_LOW / PASS_HIGH: cutoff d0
+    //             ideal      1 for D <= d0
+    //             butterworth 1 / (1 + (D/d0)^(2 order))
+    //             gaussian   e^(-D^2 / (2 d0^2))
+    //     -PASS_REJECT / PASS_BAND: band of width centred on radius d0
+    //             ideal      0 for |D - d0| <= width/2
+    //             butterworth 1 / (1 + (D width / (D^2 - d0^2))^(2 order))
+    //             gaussian   1 - e^(-((D^2 - d0^2) / (D width))^2)
+    //     -high pass and band pass are 1 minus the low pass and band reject
+    inline double Response(double d2, ResponseShape shape, PassType pass, double d0, double width, int order)
+    {
+        double h;
+        if( pass == PASS_LOW || pass == PASS_HIGH )
+        {
+            if( shape == RESPONSE_IDEAL )
+                h = d2 <= d0*d0 ? 1.0 : 0.0;
+            else if( shape == RESPONSE_BUTTERWORTH )
+                h = 1.0 / (1.0 + IntPow(d2 / (d0*d0), order));
+            else
+                h = exp(-d2 / (2.0*d0*d0));
+            return pass == PASS_LOW ? h : 1.0 - h;
+        }
+
+        double d = sqrt(d2);
+        double q = d2 - d0*d0;
+        if( shape == RESPONSE_IDEAL )
+            h = fabs(d - d0) <= width/2.0 ? 0.0 : 1.0;
+        else if( shape == RESPONSE_BUTTERWORTH )
+            h = q == 0.0 ? 0.0 : 1.0 / (1.0 + IntPow((d*width/q) * (d*width/q), order));
+        else
+            h = d == 0.0 ? 1.0 : 1.0 - exp(-(q/(d*width)) * (q/(d*width)));
+        return pass == PASS_REJECT ? h : 1.0 - h;
+    }
+
+    // -multiply by the radial response one row per index of range, the
+    //         response is evaluated on the fly so no mask is stored
+    //     -squared column frequencies are computed once per call
+    class ResponseBody : public cv::ParallelLoopBody
+    {
+     public:
+        ResponseBody(const ComplexRows<double> &spectrum, bool centred, ResponseShape shape, PassType pass, double d0, double width, int order)
+            : spectrum(spectrum), centred(centred), shape(shape), pass(pass), d0(d0), width(width), order(order) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int stride = spectrum.stride;
+            std::vector<double> v2(spectrum.cols);
+            for( int j=0; j<spectrum.cols; j++ )
+            {
+                double v = Frequency(j, spectrum.cols, centred);
+                v2[j] = v*v;
+            }
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                double u = Frequency(i, spectrum.rows, centred);
+                double *a = spectrum.Re(i);
+                double *b = spectrum.Im(i);
+                for( int j=0; j<spectrum.cols; j++ )
+                {
+                    double h = Response(u*u + v2[j], shape, pass, d0, width, order);
+                    a[j*stride] *= h;
+                    b[j*stride] *= h;
+                }
+            }
+        }
+
+     private:
+        const ComplexRows<double> &spectrum;
+        bool centred;
+        ResponseShape shape;
+        PassType pass;
+        double d0, width;
+        int order;
+    };
+
+    // -ideal, Butterworth or Gaussian low, high, band pass or band reject
+    //         filter applied in place
+    //     -the Spectrum overload takes the frequency origin from shifted,
+    //             a CV_64FC2 Mat is taken as centred unless told otherwise
+    //     -order is only used by RESPONSE_BUTTERWORTH, width only by
+    //             PASS_BAND and PASS_REJECT, where it must be positive
+    inline void BandFilter(Spectrum &spectrum, ResponseShape shape, PassType pass, double d0, double width = 0.0, int order = 2)
+    {
+        CV_Assert((pass == PASS_BAND || pass == PASS_REJECT) ? width > 0.0 : d0 > 0.0);
+        cv::parallel_for_(cv::Range(0, spectrum.rows),
+                ResponseBody(ComplexRows<double>(spectrum), spectrum.shifted, shape, pass, d0, width, order));
+    }
+
+    inline void BandFilter(cv::Mat &spectrum, ResponseShape shape, PassType pass, double d0, double width = 0.0, int order = 2, bool centred = true)
+    {
+        CV_Assert(spectrum.type() == CV_64FC2);
+        CV_Assert((pass == PASS_BAND || pass == PASS_REJECT) ? width > 0.0 : d0 > 0.0);
+        cv::parallel_for_(cv::Range(0, spectrum.rows),
+                ResponseBody(ComplexRows<double>(spectrum), centred, shape, pass, d0, width, order));
+    }
+
+    // Peak
+    // -location (x, y) and power |F|^2 of one spectral sample
+    struct Peak
+    {
+        int x, y;
+        double value;
+
+        bool operator>(const Peak &p) const
+        {
+            return value > p.value;
+        }
+    };
+
+    typedef std::priority_queue< Peak, std::vector<Peak>, std::greater<Peak> > PeakHeap;
+
+    // -local maxima of the power over one stripe of rows per index of range
+    //     -the power of the rows above, at and below the current one is kept
+    //             in a rolling buffer so each sample is squared once per row
+    //     -samples within exclude of the centre, and with symmetric set the
+    //             half plane holding the conjugate twins, are skipped
+    //     -each stripe keeps its cap strongest maxima in a bounded min-heap
+    class PeakBody : public cv::ParallelLoopBody
+    {
+     public:
+        PeakBody(const ComplexRows<double> &spectrum, double exclude, bool symmetric, int cap, int stripes, std::vector< std::vector<Peak> > &partial)
+            : spectrum(spectrum), exclude(exclude), symmetric(symmetric), cap(cap), stripes(stripes), partial(partial) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int rows = spectrum.rows;
+            const int cols = spectrum.cols;
+            const int cx = cols / 2;
+            const int cy = rows / 2;
+            std::vector<double> buffer(3 * (cols + 2), -1.0);
+
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)rows * s / stripes);
+                int last = (int)((long long)rows * (s + 1) / stripes);
+                PeakHeap heap;
+
+                for( int i=first - 1; i<=last; i++ )
+                {
+                    double *row = &buffer[((i + 3) % 3) * (cols + 2)] + 1;
+                    if( i >= 0 && i < rows )
+                    {
+                        const double *a = spectrum.Re(i);
+                        const double *b = spectrum.Im(i);
+                        const int stride = spectrum.stride;
+                        for( int j=0; j<cols; j++ )
+                            row[j] = a[j*stride]*a[j*stride] + b[j*stride]*b[j*stride];
+                    }
+                    else
+                        std::fill(row, row + cols, -1.0);
+
+                    // test the row above now its neighbours are known
+                    int y = i - 1;
+                    if( y < first )
+                        continue;
+                    const double *up = &buffer[((y + 2) % 3) * (cols + 2)] + 1;
+                    const double *mid = &buffer[((y + 3) % 3) * (cols + 2)] + 1;
+                    const double *down = row;
+                    int dy = y - cy;
+                    for( int x=0; x<cols; x++ )
+                    {
+                        int dx = x - cx;
+                        if( symmetric && (dy < 0 || (dy == 0 && dx <= 0)) )
+                            continue;
+                        if( (double)dx*dx + (double)dy*dy < exclude*exclude )
+                            continue;
+                        double v = mid[x];
+                        if( v < mid[x-1] || v < mid[x+1] || v < up[x-1] || v < up[x] || v < up[x+1]
+                                || v < down[x-1] || v < down[x] || v < down[x+1] )
+                            continue;
+                        if( (int)heap.size() < cap || v > heap.top().value )
+                        {
+                            Peak peak = {x, y, v};
+                            heap.push(peak);
+                            if( (int)heap.size() > cap )
+                                heap.pop();
+                        }
+                    }
+                }
+
+                partial[s].clear();
+                while( !heap.empty() )
+                {
+                    partial[s].push_back(heap.top());
+                    heap.pop();
+                }
+            }
+        }
+
+     private:
+        const ComplexRows<double> &spectrum;
+        double exclude;
+        bool symmetric;
+        int cap;
+        int stripes;
+        std::vector< std::vector<Peak> > &partial;
+    };
+
+    inline bool PeakOrder(const Peak &a, const Peak &b)
+    {
+        return a.value > b.value;
+    }
+
+    // -strongest |F|^2 of the upper left quadrant over one stripe of its
+    //         rows per index of range, first in row order on ties
+    class QuadrantBody : public cv::ParallelLoopBody
+    {
+     public:
+        QuadrantBody(const ComplexRows<double> &spectrum, int stripes, std::vector<Peak> &partial)
+            : spectrum(spectrum), stripes(stripes), partial(partial) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int rows = spectrum.rows / 2;
+            const int cols = spectrum.cols / 2;
+            const int stride = spectrum.stride;
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)rows * s / stripes);
+                int last = (int)((long long)rows * (s + 1) / stripes);
+                Peak best = {0, 0, -1.0};
+                for( int i=first; i<last; i++ )
+                {
+                    const double *a = spectrum.Re(i);
+                    const double *b = spectrum.Im(i);
+                    for( int j=0; j<cols; j++ )
+                    {
+                        double v = a[j*stride]*a[j*stride] + b[j*stride]*b[j*stride];
+                        if( v > best.value )
+                        {
+                            Peak p = {j, i, v};
+                            best = p;
+                        }
+                    }
+                }
+                partial[s] = best;
+            }
+        }
+
+     private:
+        const ComplexRows<double> &spectrum;
+        int stripes;
+        std::vector<Peak> &partial;
+    };
+
+    // -half the distance from the centre to the strongest sample of the
+    //         upper left quadrant, which keeps the low frequencies of the
+    //         picture out of a search for periodic noise
+    inline double Exclusion(const ComplexRows<double> &spectrum)
+    {
+        const int rows = spectrum.rows / 2;
+        if( rows == 0 || spectrum.cols / 2 == 0 )
+            return 0.0;
+
+        int stripes = std::max(1, std::min(cv::getNumThreads(), rows));
+        std::vector<Peak> partial(stripes);
+        cv::parallel_for_(cv::Range(0, stripes), QuadrantBody(spectrum, stripes, partial), stripes);
+        Peak best = partial[0];
+        for( int s=1; s<stripes; s++ )
+            if( partial[s].value > best.value )
+                best = partial[s];
+
+        double x = spectrum.cols/2.0 - best.x;
+        double y = spectrum.rows/2.0 - best.y;
+        return sqrt(x*x + y*y) / 2.0;
+    }
+
+    // -strongest k peaks of a centred complex spectrum in one pass
+    //     -candidates are 3x3 local maxima of |F|^2 at least exclude from
+    //             the centre, merged from per-thread bounded heaps
+    //     -exclude < 0 takes it from Exclusion, a reduction over a quarter
+    //             of the spectrum
+    //     -non-maximum suppression keeps the strongest of any peaks closer
+    //             than radius
+    //     -symmetric: a real image has conjugate twins F(-u,-v), so only one
+    //             half plane is searched and each of the k peaks is returned
+    //             followed by its twin
+    //     -spectrum is a CV_64FC2 Mat or a Spectrum
+    inline std::vector<Peak> FindPeaks(const ComplexRows<double> &spectrum, int k, int radius, double exclude, bool symmetric = true)
+    {
+        CV_Assert(spectrum.stride == 1 || spectrum.re.type() == CV_64FC2);
+        std::vector<Peak> peaks;
+        if( k <= 0 || spectrum.rows == 0 || spectrum.cols == 0 )
+            return peaks;
+        if( exclude < 0.0 )
+            exclude = Exclusion(spectrum);
+
+        int stripes = std::max(1, std::min(cv::getNumThreads(), spectrum.rows));
+        int cap = 8*k + 16;
+        std::vector< std::vector<Peak> > partial(stripes);
+        cv::parallel_for_(cv::Range(0, stripes), PeakBody(spectrum, exclude, symmetric, cap, stripes, partial), stripes);
+
+        std::vector<Peak> candidates;
+        for( int s=0; s<stripes; s++ )
+            candidates.insert(candidates.end(), partial[s].begin(), partial[s].end());
+        std::sort(candidates.begin(), candidates.end(), PeakOrder);
+
+        const int cx = spectrum.cols / 2;
+        const int cy = spectrum.rows / 2;
+        std::vector<Peak> kept;
+        for( size_t n=0; n<candidates.size() && (int)kept.size()<k; n++ )
+        {
+            const Peak &p = candidates[n];
+            bool clear = true;
+            for( size_t m=0; m<kept.size() && clear; m++ )
+            {
+                int dx = p.x - kept[m].x;
+                int dy = p.y - kept[m].y;
+                clear = dx*dx + dy*dy > radius*radius;
+            }
+            if( clear )
+                kept.push_back(p);
+        }
+
+        for( size_t n=0; n<kept.size(); n++ )
+        {
+            peaks.push_back(kept[n]);
+            Peak twin = {2*cx - kept[n].x, 2*cy - kept[n].y, 0.0};
+            if( symmetric && twin.x >= 0 && twin.x < spectrum.cols && twin.y >= 0 && twin.y < spectrum.rows )
+            {
+                double a = spectrum.Re(twin.y)[twin.x*spectrum.stride];
+                double b = spectrum.Im(twin.y)[twin.x*spectrum.stride];
+                twin.value = a*a + b*b;
+                peaks.push_back(twin);
+            }
+        }
+        return peaks;
+    }
+
+    // -multiply by prod_k 1 / (1 + (d0 / D_k)^(2 order)) one row per index,
+    //         D_k being the distance to peak k
+    class NotchBody : public cv::ParallelLoopBody
+    {
+     public:
+        NotchBody(const ComplexRows<double> &spectrum, const std::vector<Peak> &peaks, double d0, int order)
+            : spectrum(spectrum), peaks(peaks), d0(d0), order(order) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const double d2 = d0 * d0;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                double *a = spectrum.Re(i);
+                double *b = spectrum.Im(i);
+                const int stride = spectrum.stride;
+                for( int j=0; j<spectrum.cols; j++ )
+                {
+                    double h = 1.0;
+                    for( size_t k=0; k<peaks.size(); k++ )
+                    {
+                        double dx = j - peaks[k].x;
+                        double dy = i - peaks[k].y;
+                        double r2 = dx*dx + dy*dy;
+                        if( r2 == 0.0 )
+                        {
+                            h = 0.0;
+                            break;
+                        }
+                        h /= 1.0 + pow(d2 / r2, order);
+                    }
+                    a[j*stride] *= h;
+                    b[j*stride] *= h;
+                }
+            }
+        }
+
+     private:
+        const ComplexRows<double> &spectrum;
+        const std::vector<Peak> &peaks;
+        double d0;
+        int order;
+    };
+
+    // -Butterworth notch reject of radius d0 around every peak, in place
+    inline void NotchReject(cv::Mat &spectrum, const std::vector<Peak> &peaks, double d0, int order = 2)
+    {
+        CV_Assert(spectrum.type() == CV_64FC2);
+        if( peaks.empty() )
+            return;
+        cv::parallel_for_(cv::Range(0, spectrum.rows), NotchBody(ComplexRows<double>(spectrum), peaks, d0, order));
+    }
+
+    inline void NotchReject(Spectrum &spectrum, const std::vector<Peak> &peaks, double d0, int order = 2)
+    {
+        if( peaks.empty() )
+            return;
+        cv::parallel_for_(cv::Range(0, spectrum.rows), NotchBody(ComplexRows<double>(spectrum), peaks, d0, order));
+    }
+
+    // -padded input, the product buffer, the working sum and the returned
+    //         sum come from pool when one is given, give the result back
+    //         with pool->Release once done
+    //     -the product buffer is reused for every window
     template< typename T >
-    cv::Mat Correlation(cv::Mat& source, const cv::Mat& filter, bool normalize, bool apply)
+    cv::Mat Correlation(cv::Mat& source, const cv::Mat& filter, bool normalize, bool apply, Pool *pool = NULL)
     {
         cv::Mat padded;
-        cv::Mat dest(source.size(), CV_64F);
-        Util::PadImage<T>(padded, source, filter.cols, filter.rows);
+        cv::Mat dest = Buffer::Acquire(pool, source.rows, source.cols, CV_64F);
+        cv::Mat out = Buffer::Acquire(pool, filter.rows, filter.cols, CV_MAKETYPE(CV_64F, source.channels()));
+        Util::PadImage<T>(padded, source, filter.cols, filter.rows, pool);
         for(int i=filter.rows/2; i<source.rows + filter.rows/2; i++)
             for(int j=filter.cols/2; j<source.cols + filter.cols/2; j++)
             {
 
                 cv::Mat roi = padded(cv::Rect(j - filter.cols/2, i - filter.rows/2, filter.cols, filter.rows)); 
-                cv::Mat out;
                 cv::multiply(roi, filter, out, 1, CV_64F);
                 cv::Scalar sum = cv::sum(out);
                 for(int k=0; k<source.channels(); k++)
@@ -49,37 +459,64 @@ namespace Filter
                 }
             }
 
-        cv::Mat ret = dest.clone();
-        if(normalize)
+        // the sum is returned as is, only normalizing in place needs a copy
+        cv::Mat ret = dest;
+        if(normalize && apply && source.depth() == CV_8U)
         {
+            Util::NormalizeTo8U<double>(dest, source, 0.0, 255.0);
+        }
+        else if(normalize)
+        {
+            ret = Buffer::Acquire(pool, dest.rows, dest.cols, dest.type());
+            dest.copyTo(ret);
             Util::Normalize<double>(dest, cv::Scalar(255.0), 0);
+            if(apply)
+            {
+                dest.convertTo(source, source.type(), 1.0);
+            }
+            Buffer::Release(pool, dest);
         }
-        if(apply)
+        else if(apply)
         {
             dest.convertTo(source, source.type(), 1.0);
         }
 
+        Buffer::Release(pool, out);
+        Buffer::Release(pool, padded);
         return ret;
     }
 
+    // -padded input, the window buffer and the returned median come from
+    //         pool when one is given, give the result back with
+    //         pool->Release once done
+    //     -each window is copied into one reused buffer rather than a
+    //             fresh clone
     template< typename T >
-    cv::Mat Median(cv::Mat& source, int filterSize, bool apply)
+    cv::Mat Median(cv::Mat& source, int filterSize, bool apply, Pool *pool = NULL)
     {
         cv::Mat padded;
-        cv::Mat dest(source.size(), CV_8U);
-        Util::PadImage<T>(padded, source, filterSize, filterSize);
+        cv::Mat dest = Buffer::Acquire(pool, source.rows, source.cols, CV_8U);
+        cv::Mat buffer = Buffer::Acquire(pool, 1, filterSize*filterSize, CV_8U);
+        uchar *window = buffer.data;
+        Util::PadImage<T>(padded, source, filterSize, filterSize, pool);
         for(int i=filterSize/2; i<source.rows + filterSize/2; i++)
             for(int j=filterSize/2; j<source.cols + filterSize/2; j++)
             {
-                cv::Mat roi = padded(cv::Rect(j - filterSize/2, i - filterSize/2, filterSize, filterSize)).clone();
-                std::nth_element(roi.data, roi.data+(filterSize*filterSize)/2, roi.dataend); //only median is sorted
-                dest.at<T>(i-filterSize/2, j-filterSize/2) = roi.at<uchar>(filterSize/2,filterSize/2);
+                for(int y=0; y<filterSize; y++)
+                {
+                    const uchar *p = padded.ptr<uchar>(i - filterSize/2 + y) + (j - filterSize/2);
+                    std::copy(p, p + filterSize, &window[y*filterSize]);
+                }
+                std::nth_element(window, window+(filterSize*filterSize)/2, window+filterSize*filterSize); //only median is sorted
+                dest.at<T>(i-filterSize/2, j-filterSize/2) = window[(filterSize*filterSize)/2];
             }
 
         if(apply)
         {
             dest.convertTo(source, source.type(), 1.0);
         }
+        Buffer::Release(pool, buffer);
+        Buffer::Release(pool, padded);
         return dest;
     }
 
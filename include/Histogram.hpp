@@ -0,0 +1,161 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <algorithm>
+
+namespace Histogram
+{
+    // -number of bins for an 8 or 16 bit image
+    inline int Bins(const cv::Mat &source)
+    {
+        CV_Assert(source.depth() == CV_8U || source.depth() == CV_16U);
+        return source.depth() == CV_8U ? 256 : 65536;
+    }
+
+    // -add one channel of rows [first, last) of source into counts
+    //     -consecutive pixels go to interleaved sub-histograms so runs of
+    //             equal values do not wait on the same bin (8 bit only, four
+    //             copies of 64k bins would not stay in cache)
+    //     -sub is scratch space for the sub-histograms, zero on entry and exit
+    template< typename C >
+    void Accumulate(const cv::Mat &source, int channel, int first, int last, int *counts, std::vector<int> &sub)
+    {
+        const int bins = Bins(source);
+        const int ways = bins <= 256 ? 4 : 1;
+        const int cn = source.channels();
+        sub.resize(ways * bins, 0);
+        int *h0 = &sub[0];
+        int *h1 = &sub[(1 % ways) * bins];
+        int *h2 = &sub[(2 % ways) * bins];
+        int *h3 = &sub[(3 % ways) * bins];
+
+        for( int i=first; i<last; i++ )
+        {
+            const C *p = source.ptr<C>(i) + channel;
+            int j = 0;
+            for( ; j<=source.cols - 4; j+=4, p+=4*cn )
+            {
+                h0[p[0]]++;
+                h1[p[cn]]++;
+                h2[p[2*cn]]++;
+                h3[p[3*cn]]++;
+            }
+            for( ; j<source.cols; j++, p+=cn )
+                h0[p[0]]++;
+        }
+
+        for( int w=0; w<ways; w++ )
+            for( int b=0; b<bins; b++ )
+                counts[b] += sub[w*bins + b];
+        std::fill(sub.begin(), sub.end(), 0);
+    }
+
+    // -count one horizontal stripe of the image per index of range
+    //     -each stripe writes its own partial so no locking is needed
+    template< typename C >
+    class CountBody : public cv::ParallelLoopBody
+    {
+     public:
+        CountBody(const cv::Mat &source, int channel, int stripes, std::vector< std::vector<int> > &partial)
+            : source(source), channel(channel), stripes(stripes), partial(partial) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            std::vector<int> sub;
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)source.rows * s / stripes);
+                int last = (int)((long long)source.rows * (s + 1) / stripes);
+                partial[s].assign(Bins(source), 0);
+                Accumulate<C>(source, channel, first, last, &partial[s][0], sub);
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        int channel;
+        int stripes;
+        std::vector< std::vector<int> > &partial;
+    };
+
+    // -count the values of one channel of an 8 or 16 bit image
+    //     -one stripe of rows per thread, partials merged at the end
+    inline void Count(const cv::Mat &source, int channel, std::vector<int> &counts)
+    {
+        const int bins = Bins(source);
+        int stripes = std::max(1, std::min(cv::getNumThreads(), source.rows));
+        std::vector< std::vector<int> > partial(stripes);
+
+        if( source.depth() == CV_8U )
+            cv::parallel_for_(cv::Range(0, stripes), CountBody<uchar>(source, channel, stripes, partial), stripes);
+        else
+            cv::parallel_for_(cv::Range(0, stripes), CountBody<ushort>(source, channel, stripes, partial), stripes);
+
+        counts.assign(bins, 0);
+        for( int s=0; s<stripes; s++ )
+            for( int b=0; b<bins; b++ )
+                counts[b] += partial[s][b];
+    }
+
+    // -histogram row 0 holds the PDF H = counts * 1/MN and row 1 the CDF,
+    //         the CDF is taken from running integer counts so the last
+    //         bin is exactly 1
+    inline void Normalize(cv::Mat &histogram, const std::vector<int> &counts)
+    {
+        const int bins = (int)counts.size();
+        if( histogram.rows < 2 || histogram.cols != bins || histogram.type() != CV_64F )
+            histogram = cv::Mat(2, bins, CV_64F, cv::Scalar(0.0));
+
+        long long total = 0;
+        for( int b=0; b<bins; b++ )
+            total += counts[b];
+        double scale = total > 0 ? 1.0 / total : 0.0;
+
+        double *pdf = histogram.ptr<double>(0);
+        double *cdf = histogram.ptr<double>(1);
+        long long sum = 0;
+        for( int b=0; b<bins; b++ )
+        {
+            sum += counts[b];
+            pdf[b] = counts[b] * scale;
+            cdf[b] = sum * scale;
+        }
+    }
+
+    // -clip counts at limit and hand the excess back evenly over the bins,
+    //         what does not divide evenly goes one count at a time to bins
+    //         spread across the range
+    inline void Clip(int *counts, int bins, int limit)
+    {
+        int excess = 0;
+        for( int b=0; b<bins; b++ )
+            if( counts[b] > limit )
+            {
+                excess += counts[b] - limit;
+                counts[b] = limit;
+            }
+
+        int add = excess / bins;
+        int rest = excess - add * bins;
+        for( int b=0; b<bins; b++ )
+            counts[b] += add;
+        if( rest > 0 )
+        {
+            int step = std::max(bins / rest, 1);
+            for( int b=0; b<bins && rest>0; b+=step, rest-- )
+                counts[b]++;
+        }
+    }
+
+    // -PDF and CDF of one channel of source into a 2 x bins histogram
+    inline void Create(cv::Mat &histogram, const cv::Mat &source, int channel)
+    {
+        std::vector<int> counts;
+        Count(source, channel, counts);
+        Normalize(histogram, counts);
+    }
+}
+
+#endif
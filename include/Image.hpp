@@ -5,6 +5,7 @@
 #include "AffineTransform.hpp"
 #include "Interpolate.hpp"
 #include "Util.hpp"
+#include "Spectrum.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
@@ -17,21 +18,29 @@
 enum MatType {GRAY = 0, COLOR = 1};
 enum HType {HPDF = 0, HCDF = 1, ERROR = 2};
 enum FFTPlot {RE = 0, IM = 1, MAG = 2, PHZ = 3};
+enum Ownership {COPY = 0, WRAP = 1};
 
 
 // Image class
 // -holds data for image operations
+// -copies are deep, moves and WRAP share the pixel buffer, a Mat is
+//         cloned unless WRAP is asked for (ROI and row headers share
+//         their parent even as temporaries)
 template< typename T >
 class Image {
  public:
     Image(const char*, MatType);
     Image(const Image<T>&);
+    Image(Image<T>&&);
     Image(const cv::Mat& m = cv::Mat());
+    Image(const cv::Mat&, Ownership);
     Image(const cv::Mat&, int width, int height = 400, int size = 256, enum HType = HPDF);
     Image(const cv::Mat&, int width, int height = 400, int size = 256, enum FFTPlot = MAG);
+    Image(const Spectrum&, int width, int height = 400, int size = 256, enum FFTPlot = MAG);
     ~Image();
 
     Image<T>& operator=(const Image<T>&);
+    Image<T>& operator=(Image<T>&&);
 
     cv::Mat source;
     cv::Mat histogram;
@@ -39,6 +48,32 @@ class Image {
 
 };
 
+
+// ImageView class
+// -non-owning window onto pixels held elsewhere (an Image, a Mat or a raw
+//         buffer), the owner must outlive the view
+// -views of views and Mat headers over the view never copy pixels
+template< typename T >
+class ImageView {
+ public:
+    ImageView();
+    ImageView(T* data, int rows, int cols, size_t step = 0);
+    ImageView(cv::Mat&);
+    ImageView(cv::Mat&, const cv::Rect&);
+    ImageView(Image<T>&, const cv::Rect&);
+
+    T* ptr(int i) const;
+    T& operator()(int i, int j) const;
+    ImageView<T> Region(const cv::Rect&) const;
+    cv::Mat Header() const;
+    bool empty() const;
+
+    T* data;
+    int rows;
+    int cols;
+    size_t step;
+};
+
 template< typename T >
 Image<T>::Image(const char* filename, MatType type)
 {
@@ -50,6 +85,17 @@ Image<T>::Image(const Image& image)
 {
     this->source = image.source.clone();
     this->histogram = image.histogram.clone();
+    this->squareError = image.squareError.clone();
+}
+
+// -take over the buffers of image, leaving it empty
+template< typename T >
+Image<T>::Image(Image&& image)
+    : source(image.source), histogram(image.histogram), squareError(image.squareError)
+{
+    image.source.release();
+    image.histogram.release();
+    image.squareError.release();
 }
 
 template<typename T >
@@ -58,6 +104,13 @@ Image<T>::Image(const cv::Mat &src)
     this->source = src.clone();
 }
 
+// -WRAP shares the pixels of src (no copy), COPY clones them
+template<typename T >
+Image<T>::Image(const cv::Mat &src, Ownership ownership)
+{
+    this->source = ownership == WRAP ? src : src.clone();
+}
+
 // -create image of histogram
 template<typename T >
 Image<T>::Image(const cv::Mat &hist, int width, int height, int size, HType type)
@@ -98,38 +151,35 @@ Image<T>::Image(const cv::Mat &hist, int width, int height, int size, HType type
     }
 }
 
-// -plot fft data
+// -plot fft data of an interleaved CV_64FC2 Mat
 template<typename T >
 Image<T>::Image(const cv::Mat &fft, int width, int height, int size, FFTPlot type)
+    : Image(Spectrum(fft), width, height, size, type)
+{
+}
+
+// -plot fft data, RE and IM read the planes directly
+template<typename T >
+Image<T>::Image(const Spectrum &fft, int width, int height, int size, FFTPlot type)
 {
     this->source = cv::Mat(height, width, CV_8U, cv::Scalar(0.0));
     double minVal, maxVal;
 
-    std::vector<cv::Mat> channels(2);
-
-    cv::split(fft, channels);
     cv::Mat mag;
     cv::Mat phz;
 
     if ( type == RE )
-        cv::minMaxLoc(channels[0], &minVal, &maxVal);
+        cv::minMaxLoc(fft.re, &minVal, &maxVal);
     else if ( type == IM )
-        cv::minMaxLoc(channels[1], &minVal, &maxVal);
+        cv::minMaxLoc(fft.im, &minVal, &maxVal);
     else if ( type == MAG )
     {
-        cv::Mat reSqr;
-        cv::Mat imSqr;
-        cv::multiply(channels[0], channels[0], reSqr);
-        cv::multiply(channels[1], channels[1], imSqr);
-        cv::sqrt(reSqr + imSqr, mag);
+        Util::Spectrum(fft, mag, SPEC_MAG);
         cv::minMaxLoc(mag, &minVal, &maxVal);
     }
     else if ( type == PHZ )
     {
-        phz = cv::Mat(channels[0].rows, channels[0].cols, CV_64FC1);
-        for ( int i = 0; i < channels[0].rows; ++i )
-            for ( int j = 0; j < channels[1].cols; ++j )
-                phz.at<double>(i,j) = atan2(channels[1].at<double>(i,j), channels[0].at<double>(i,j));
+        Util::Spectrum(fft, phz, SPEC_PHASE);
         cv::minMaxLoc(phz, &minVal, &maxVal);
     }
     else
@@ -147,9 +197,9 @@ Image<T>::Image(const cv::Mat &fft, int width, int height, int size, FFTPlot typ
 
     cv::Mat img;
     if( type == RE )
-        img = channels[0];
+        img = fft.re;
     else if( type == IM )
-        img = channels[1];
+        img = fft.im;
     else if ( type == MAG )
         img = mag;
     else if ( type == PHZ )
@@ -176,9 +226,26 @@ Image<T>::Image(const cv::Mat &fft, int width, int height, int size, FFTPlot typ
 template< typename T>
 Image<T>& Image<T>::operator=(const Image<T> &image)
 {
-    if( !this == image)
+    if( this != &image )
     {
-        this->source = image.clone();
+        this->source = image.source.clone();
+        this->histogram = image.histogram.clone();
+        this->squareError = image.squareError.clone();
+    }
+    return *this;
+}
+
+template< typename T>
+Image<T>& Image<T>::operator=(Image<T> &&image)
+{
+    if( this != &image )
+    {
+        this->source = image.source;
+        this->histogram = image.histogram;
+        this->squareError = image.squareError;
+        image.source.release();
+        image.histogram.release();
+        image.squareError.release();
     }
     return *this;
 }
@@ -188,4 +255,75 @@ Image<T>::~Image()
 {
 }
 
+
+template< typename T >
+ImageView<T>::ImageView()
+    : data(NULL), rows(0), cols(0), step(0)
+{
+}
+
+// -step is in bytes, 0 for tightly packed rows
+template< typename T >
+ImageView<T>::ImageView(T* data, int rows, int cols, size_t step)
+    : data(data), rows(rows), cols(cols), step(step ? step : cols * sizeof(T))
+{
+}
+
+template< typename T >
+ImageView<T>::ImageView(cv::Mat &m)
+    : data(m.empty() ? NULL : m.ptr<T>(0)), rows(m.rows), cols(m.cols), step(m.step)
+{
+    assert( m.empty() || m.elemSize() == sizeof(T) );
+}
+
+template< typename T >
+ImageView<T>::ImageView(cv::Mat &m, const cv::Rect &roi)
+{
+    *this = ImageView<T>(m).Region(roi);
+}
+
+template< typename T >
+ImageView<T>::ImageView(Image<T> &image, const cv::Rect &roi)
+{
+    *this = ImageView<T>(image.source).Region(roi);
+}
+
+template< typename T >
+T* ImageView<T>::ptr(int i) const
+{
+    return (T*)((uchar*)this->data + i * this->step);
+}
+
+template< typename T >
+T& ImageView<T>::operator()(int i, int j) const
+{
+    return ptr(i)[j];
+}
+
+// -sub-window in this view's coordinates, clipped to the view
+template< typename T >
+ImageView<T> ImageView<T>::Region(const cv::Rect &roi) const
+{
+    cv::Rect r = roi & cv::Rect(0, 0, this->cols, this->rows);
+    if( r.area() == 0 )
+        return ImageView<T>();
+    return ImageView<T>(ptr(r.y) + r.x, r.height, r.width, this->step);
+}
+
+// -Mat header over the same pixels for the existing operations, it does
+//         not reference count the buffer
+template< typename T >
+cv::Mat ImageView<T>::Header() const
+{
+    if( empty() )
+        return cv::Mat();
+    return cv::Mat(this->rows, this->cols, cv::DataType<T>::type, (void*)this->data, this->step);
+}
+
+template< typename T >
+bool ImageView<T>::empty() const
+{
+    return this->data == NULL || this->rows == 0 || this->cols == 0;
+}
+
 #endif
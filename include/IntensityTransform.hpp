@@ -2,31 +2,103 @@
 #define INTENSITYTRANSFORM_H
 
 #include "Util.hpp"
+#include "Histogram.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <cmath>
 
 namespace IntensityTransform
 {
+    // -apply 256 entry tables to every row of an 8 bit image
+    //     -a single channel LUT maps the chosen channel, a LUT with one
+    //             channel per image channel maps each channel through its own
+    //             table when channel < 0
+    //     -contiguous rows of a single channel image are mapped 8 values at a
+    //             time so the loads and stores stay independent
+    class LUTBody : public cv::ParallelLoopBody
+    {
+     public:
+        LUTBody(cv::Mat &source, const cv::Mat &lut, int channel)
+            : source(source), lut(lut), channel(channel) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int cn = source.channels();
+            const int lcn = lut.channels();
+            const uchar *table = lut.ptr<uchar>(0);
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                uchar *p = source.ptr<uchar>(i);
+                if( cn == 1 )
+                {
+                    const int width = source.cols;
+                    int j = 0;
+                    for( ; j<=width - 8; j+=8 )
+                    {
+                        uchar v0 = table[p[j]], v1 = table[p[j+1]], v2 = table[p[j+2]], v3 = table[p[j+3]];
+                        uchar v4 = table[p[j+4]], v5 = table[p[j+5]], v6 = table[p[j+6]], v7 = table[p[j+7]];
+                        p[j] = v0; p[j+1] = v1; p[j+2] = v2; p[j+3] = v3;
+                        p[j+4] = v4; p[j+5] = v5; p[j+6] = v6; p[j+7] = v7;
+                    }
+                    for( ; j<width; j++ )
+                        p[j] = table[p[j]];
+                }
+                else if( channel >= 0 )
+                {
+                    const int k = lcn == 1 ? 0 : channel;
+                    for( int j=0; j<source.cols; j++ )
+                        p[j*cn + channel] = table[p[j*cn + channel]*lcn + k];
+                }
+                else
+                {
+                    for( int j=0; j<source.cols; j++ )
+                        for( int k=0; k<cn; k++ )
+                            p[j*cn + k] = table[p[j*cn + k]*lcn + (lcn == 1 ? 0 : k)];
+                }
+            }
+        }
+
+     private:
+        cv::Mat &source;
+        const cv::Mat &lut;
+        int channel;
+    };
+
+    // -replace each value v in the image with lut(v)
+    //     -lut is 1 x 256 CV_8U with either one channel or one per image
+    //             channel, channel < 0 maps every channel
+    template< typename T >
+    void ApplyLUT(cv::Mat &source, const cv::Mat &lut, int channel)
+    {
+        CV_Assert(source.depth() == CV_8U && lut.depth() == CV_8U && lut.total() == 256);
+        CV_Assert(lut.channels() == 1 || lut.channels() == source.channels());
+        cv::Mat table = lut.isContinuous() ? lut : lut.clone();
+        if( source.channels() == 1 )
+            channel = 0;
+        cv::parallel_for_(cv::Range(0, source.rows), LUTBody(source, table, channel));
+    }
+
     // -find binary number for next power of 2 above level (desired bit restriction 2^level)
     //      and subtract 1 to get mask
-    //      -AND all values in image to restrict possible values to 2^level
+    //      -AND all values in the table to restrict possible values to 2^level
     template< typename T>
     void Quantize(cv::Mat &source, int level, int channel)
     {
         uchar filter = pow(2, 8 - level) - 1;
         filter ^= 0xff;
 
-        for(int i=0; i<source.rows; i++)
-            for(int j=0; j<source.cols; j++)
-                source.at<uchar>(i,j,channel) &= filter;
+        cv::Mat lookup(1, 256, CV_8U);
+        for( int v=0; v<256; v++ )
+            lookup.at<uchar>(0, v) = v & filter;
+        ApplyLUT<T>(source, lookup, channel);
     }
 
+    // -PDF and CDF in one pass over integer counts (8 or 16 bit source)
     template< typename T >
     void CreateHistogram(cv::Mat &histogram, const cv::Mat& source, int channel)
     {
-        Util::PDF<T>(histogram, source, channel);
-        Util::CDF<T>(histogram, channel);
+        Histogram::Create(histogram, source, channel);
     }
 
     // -get histograms for two images passed (as member variable and parameter)
@@ -43,24 +115,279 @@ namespace IntensityTransform
         cv::Mat lookup;
         Util::CreateLookup<T>(lookup, histogram, hdest, channel);
 
-         for( int i=0; i<source.rows; i++ )
-            for( int j=0; j<source.cols; j++ )
-                source.at<uchar>(i, j, channel) = (uchar)lookup.at<uchar>(0, source.at<uchar>(i, j, channel));
-     
+        ApplyLUT<T>(source, lookup, channel);
     }
 
     // -create histogram
-    //      and replace each value in the image with the value referenced 
-    //      in the CDF [0,1] and unnormalize (val*255)
+    //      and build a table of the CDF [0,1] unnormalized (val*255)
+    //      -replace each value in the image with its table entry
     template< typename T >
     void Equalize(cv::Mat &source, int size, int channel)
     {
         cv::Mat histogram = cv::Mat(2, size, CV_64F, cv::Scalar(0.0));
         CreateHistogram<T>(histogram, source, channel);
 
+        cv::Mat lookup(1, 256, CV_8U);
+        for( int v=0; v<256; v++ )
+            lookup.at<uchar>(0, v) = (uchar)(histogram.at<double>(1, v) *255);
+        ApplyLUT<T>(source, lookup, channel);
+    }
+
+    // -tile t of n along a line of length size covers [size*t/n, size*(t+1)/n)
+    inline int TileEdge(int size, int n, int t)
+    {
+        return (int)((long long)size * t / n);
+    }
+
+    // -for every position along a line find the two tile centres around it
+    //         and the weight of the second, positions before the first or
+    //         after the last centre take that tile alone
+    inline void TileWeights(int size, int n, std::vector<int> &t0, std::vector<int> &t1, std::vector<float> &w)
+    {
+        std::vector<double> centre(n);
+        for( int t=0; t<n; t++ )
+            centre[t] = (TileEdge(size, n, t) + TileEdge(size, n, t + 1) - 1) * 0.5;
+
+        t0.resize(size);
+        t1.resize(size);
+        w.resize(size);
+        int t = 0;
+        for( int x=0; x<size; x++ )
+        {
+            while( t < n - 1 && centre[t + 1] <= x )
+                t++;
+            t0[x] = t;
+            t1[x] = std::min(t + 1, n - 1);
+            double f = t1[x] == t0[x] ? 0.0 : (x - centre[t]) / (centre[t1[x]] - centre[t]);
+            w[x] = (float)std::min(std::max(f, 0.0), 1.0);
+        }
+    }
+
+    // -histogram, clip and turn into a 256 entry table each tile in range
+    class TileLUTBody : public cv::ParallelLoopBody
+    {
+     public:
+        TileLUTBody(const cv::Mat &source, cv::Mat &luts, int tilesX, int tilesY, double clipLimit, int channel)
+            : source(source), luts(luts), tilesX(tilesX), tilesY(tilesY), clipLimit(clipLimit), channel(channel) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            std::vector<int> sub;
+            int counts[256];
+            for( int t=range.start; t<range.end; t++ )
+            {
+                int tx = t % tilesX;
+                int ty = t / tilesX;
+                cv::Rect rect(TileEdge(source.cols, tilesX, tx), TileEdge(source.rows, tilesY, ty), 0, 0);
+                rect.width = TileEdge(source.cols, tilesX, tx + 1) - rect.x;
+                rect.height = TileEdge(source.rows, tilesY, ty + 1) - rect.y;
+                cv::Mat tile = source(rect);
+                int area = rect.area();
+
+                std::fill(counts, counts + 256, 0);
+                Histogram::Accumulate<uchar>(tile, channel, 0, tile.rows, counts, sub);
+                if( clipLimit > 0.0 )
+                    Histogram::Clip(counts, 256, std::max(1, (int)(clipLimit * area / 256)));
+
+                uchar *lut = luts.ptr<uchar>(t);
+                double scale = area > 0 ? 255.0 / area : 0.0;
+                int sum = 0;
+                for( int v=0; v<256; v++ )
+                {
+                    sum += counts[v];
+                    lut[v] = cv::saturate_cast<uchar>(sum * scale);
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        cv::Mat &luts;
+        int tilesX, tilesY;
+        double clipLimit;
+        int channel;
+    };
+
+    // -map every pixel through the four surrounding tile tables, blended
+    //         bilinearly by its position between the tile centres
+    class TileMapBody : public cv::ParallelLoopBody
+    {
+     public:
+        TileMapBody(cv::Mat &source, const cv::Mat &luts, int tilesX, int tilesY, int channel)
+            : source(source), luts(luts), tilesX(tilesX), channel(channel)
+        {
+            TileWeights(source.cols, tilesX, x0, x1, wx);
+            TileWeights(source.rows, tilesY, y0, y1, wy);
+        }
+
+        void operator()(const cv::Range &range) const
+        {
+            const int cn = source.channels();
+            for( int i=range.start; i<range.end; i++ )
+            {
+                uchar *p = source.ptr<uchar>(i) + channel;
+                const uchar *top = luts.ptr<uchar>(y0[i] * tilesX);
+                const uchar *bottom = luts.ptr<uchar>(y1[i] * tilesX);
+                float fy = wy[i];
+                for( int j=0; j<source.cols; j++, p+=cn )
+                {
+                    int v = *p;
+                    int a = x0[j] * 256 + v;
+                    int b = x1[j] * 256 + v;
+                    float fx = wx[j];
+                    float t = top[a] + fx * (top[b] - top[a]);
+                    float u = bottom[a] + fx * (bottom[b] - bottom[a]);
+                    *p = cv::saturate_cast<uchar>(t + fy * (u - t));
+                }
+            }
+        }
+
+     private:
+        cv::Mat &source;
+        const cv::Mat &luts;
+        int tilesX;
+        int channel;
+        std::vector<int> x0, x1, y0, y1;
+        std::vector<float> wx, wy;
+    };
+
+    // -contrast limited adaptive equalization of an 8 bit channel
+    //     -split the image into tilesX x tilesY tiles, histogram each tile
+    //             once and clip it at clipLimit times the mean bin count
+    //             (clipLimit <= 0 does not clip)
+    //     -each tile's clipped CDF becomes its lookup table
+    //     -every pixel is mapped through the tables of the four nearest tile
+    //             centres, interpolated bilinearly
+    //     -two passes over the image whatever the number of tiles
+    template< typename T >
+    void AdaptiveEqualize(cv::Mat &source, int tilesX, int tilesY, double clipLimit, int channel)
+    {
+        CV_Assert(source.depth() == CV_8U);
+        tilesX = std::min(std::max(tilesX, 1), source.cols);
+        tilesY = std::min(std::max(tilesY, 1), source.rows);
+
+        cv::Mat luts(tilesX * tilesY, 256, CV_8U);
+        cv::parallel_for_(cv::Range(0, tilesX * tilesY), TileLUTBody(source, luts, tilesX, tilesY, clipLimit, channel));
+        cv::parallel_for_(cv::Range(0, source.rows), TileMapBody(source, luts, tilesX, tilesY, channel));
+    }
+
+    // -equalize a band of rows with the histogram of a window centred on
+    //         each pixel
+    //     -the window histogram slides right one column at a time, removing
+    //             the column that leaves and adding the one that enters
+    //     -the histogram at the start of each row slides down the same way
+    class WindowBody : public cv::ParallelLoopBody
+    {
+     public:
+        WindowBody(const cv::Mat &plane, cv::Mat &source, int radius, double clipLimit, int channel)
+            : plane(plane), source(source), radius(radius), clipLimit(clipLimit), channel(channel) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int cn = source.channels();
+            int start[256];
+            int counts[256];
+            std::fill(start, start + 256, 0);
+
+            // window for (range.start, 0)
+            int top = std::max(range.start - radius, 0);
+            int bottom = std::min(range.start + radius + 1, plane.rows);
+            int right = std::min(radius + 1, plane.cols);
+            for( int y=top; y<bottom; y++ )
+            {
+                const uchar *s = plane.ptr<uchar>(y);
+                for( int x=0; x<right; x++ )
+                    start[s[x]]++;
+            }
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                if( i > range.start )
+                {
+                    if( i - radius - 1 >= 0 )
+                    {
+                        const uchar *s = plane.ptr<uchar>(i - radius - 1);
+                        for( int x=0; x<right; x++ )
+                            start[s[x]]--;
+                    }
+                    if( i + radius < plane.rows )
+                    {
+                        const uchar *s = plane.ptr<uchar>(i + radius);
+                        for( int x=0; x<right; x++ )
+                            start[s[x]]++;
+                    }
+                }
+
+                top = std::max(i - radius, 0);
+                bottom = std::min(i + radius + 1, plane.rows);
+                std::copy(start, start + 256, counts);
+                const uchar *s = plane.ptr<uchar>(i);
+                uchar *d = source.ptr<uchar>(i) + channel;
+
+                for( int j=0; j<plane.cols; j++, d+=cn )
+                {
+                    if( j > 0 )
+                    {
+                        if( j - radius - 1 >= 0 )
+                            for( int y=top; y<bottom; y++ )
+                                counts[plane.ptr<uchar>(y)[j - radius - 1]]--;
+                        if( j + radius < plane.cols )
+                            for( int y=top; y<bottom; y++ )
+                                counts[plane.ptr<uchar>(y)[j + radius]]++;
+                    }
+
+                    int width = std::min(j + radius + 1, plane.cols) - std::max(j - radius, 0);
+                    int area = width * (bottom - top);
+                    int limit = clipLimit > 0.0 ? std::max(1, (int)(clipLimit * area / 256)) : area;
+
+                    // clipped CDF at v plus the share of the excess below v
+                    int v = s[j];
+                    int excess = 0;
+                    int sum = 0;
+                    for( int b=0; b<256; b++ )
+                    {
+                        int h = counts[b];
+                        if( h > limit )
+                        {
+                            excess += h - limit;
+                            h = limit;
+                        }
+                        if( b <= v )
+                            sum += h;
+                    }
+                    double cdf = sum + excess * (v + 1) / 256.0;
+                    *d = cv::saturate_cast<uchar>(cdf * 255.0 / area);
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &plane;
+        cv::Mat &source;
+        int radius;
+        double clipLimit;
+        int channel;
+    };
+
+    // -contrast limited equalization of an 8 bit channel against the
+    //         (2*radius + 1) square window around every pixel, windows are
+    //         clipped to the image
+    //     -histograms are updated incrementally as the window moves so each
+    //             pixel costs O(radius) updates plus one pass over the bins
+    template< typename T >
+    void AdaptiveEqualizeWindow(cv::Mat &source, int radius, double clipLimit, int channel)
+    {
+        CV_Assert(source.depth() == CV_8U);
+        const int cn = source.channels();
+        cv::Mat plane(source.rows, source.cols, CV_8U);
         for( int i=0; i<source.rows; i++ )
+        {
+            const uchar *s = source.ptr<uchar>(i) + channel;
+            uchar *d = plane.ptr<uchar>(i);
             for( int j=0; j<source.cols; j++ )
-                source.at<uchar>(i, j, channel) = (uchar)(histogram.at<double>(1, source.at<uchar>(i, j, channel)) *255);
+                d[j] = s[j*cn];
+        }
+        cv::parallel_for_(cv::Range(0, source.rows), WindowBody(plane, source, std::max(radius, 0), clipLimit, channel));
     }
 }
 
@@ -4,6 +4,8 @@
 #include <opencv2/opencv.hpp>
 #include <math.h>
 
+enum InterpolateType {LANCZOS3 = 5, BICUBIC = 4, BILINEAR = 3, AVERAGE = 2, NEIGHBOR = 1};
+
 namespace Interpolate
 {
     template< typename T>
@@ -63,6 +65,37 @@ namespace Interpolate
         return source.at<T>( cv::Point(nx, ny) );
     }
 
+    // -sample channel of source at (x, y) given as plain doubles
+    //     -NEIGHBOR clamps to the border like NearestNeighbor
+    //     -otherwise bilinear, reading 0 outside the image like Bilinear
+    template< typename T >
+    double Sample(const cv::Mat &source, double x, double y, InterpolateType type, int channel = 0)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int cn = source.channels();
+        if( type == NEIGHBOR )
+        {
+            int nx = (int)round( x );
+            int ny = (int)round( y );
+            nx = nx < 0 ? 0 : (nx >= source.cols ? source.cols - 1 : nx);
+            ny = ny < 0 ? 0 : (ny >= source.rows ? source.rows - 1 : ny);
+            return source.ptr<C>(ny)[nx*cn + channel];
+        }
+
+        int x0 = (int)floor( x );
+        int y0 = (int)floor( y );
+        double fx = x - x0;
+        double fy = y - y0;
+        double v[4];
+        for( int k=0; k<4; k++ )
+        {
+            int xk = x0 + (k & 1);
+            int yk = y0 + (k >> 1);
+            v[k] = (xk < 0 || xk >= source.cols || yk < 0 || yk >= source.rows) ? 0.0 : source.ptr<C>(yk)[xk*cn + channel];
+        }
+        return (1.0 - fy)*((1.0 - fx)*v[0] + fx*v[1]) + fy*((1.0 - fx)*v[2] + fx*v[3]);
+    }
+
 }
 
 #endif
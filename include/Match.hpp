@@ -0,0 +1,549 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "Spectrum.hpp"
+#include "Filter.hpp"
+#include "Pyramid.hpp"
+#include "FFT.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <map>
+
+
+namespace Match
+{
+    // -channel 0 of pattern as CV_64F less its mean, norm set to its
+    //         Euclidean norm
+    template< typename T >
+    cv::Mat ZeroMean(const cv::Mat &pattern, double &norm)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int cn = pattern.channels();
+        cv::Mat zero(pattern.rows, pattern.cols, CV_64F);
+        double mean = 0.0;
+        for( int i=0; i<pattern.rows; i++ )
+        {
+            const C *p = pattern.ptr<C>(i);
+            double *z = zero.ptr<double>(i);
+            for( int j=0; j<pattern.cols; j++ )
+                mean += z[j] = p[j*cn];
+        }
+        mean /= (double)pattern.rows * pattern.cols;
+        norm = 0.0;
+        for( int i=0; i<pattern.rows; i++ )
+        {
+            double *z = zero.ptr<double>(i);
+            for( int j=0; j<pattern.cols; j++ )
+            {
+                z[j] -= mean;
+                norm += z[j] * z[j];
+            }
+        }
+        norm = sqrt(norm);
+        return zero;
+    }
+
+    // -interleaved integral table of I and I^2 over channel 0 of source,
+    //         (rows + 1) x (cols + 1) pairs built in one pass
+    template< typename T >
+    std::vector<double> Integral(const cv::Mat &source)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int rows = source.rows;
+        const int cols = source.cols;
+        const int cn = source.channels();
+        const int stride = (cols + 1) * 2;
+        std::vector<double> sums((rows + 1) * stride, 0.0);
+        for( int i=0; i<rows; i++ )
+        {
+            const C *p = source.ptr<C>(i);
+            const double *up = &sums[i * stride];
+            double *d = &sums[(i + 1) * stride];
+            double run[2] = {0.0, 0.0};
+            for( int j=0; j<cols; j++ )
+            {
+                double v = p[j*cn];
+                run[0] += v;
+                run[1] += v * v;
+                d[(j + 1)*2] = up[(j + 1)*2] + run[0];
+                d[(j + 1)*2 + 1] = up[(j + 1)*2 + 1] + run[1];
+            }
+        }
+        return sums;
+    }
+
+    // -numerator over the product of the window and pattern deviations,
+    //         s1 and s2 the window sum and sum of squares over n samples,
+    //         flat windows (no variance) score 0
+    inline double Normalize(double numerator, double s1, double s2, double n, double norm)
+    {
+        double var = s2 - s1*s1/n;
+        if( var <= 1e-12 * s2 || norm <= 0.0 )
+            return 0.0;
+        return std::max(-1.0, std::min(1.0, numerator / (sqrt(var) * norm)));
+    }
+
+    // -normalized cross-correlation of a pattern at every top left position
+    //         where it lies inside the image, one row per index of range
+    //     -numerator: correlation of the image with the zero mean pattern,
+    //             read at the pattern centre
+    //     -window sum and sum of squares of the image from the interleaved
+    //             integral table, so each score costs the same whatever the
+    //             pattern size
+    class ScoreBody : public cv::ParallelLoopBody
+    {
+     public:
+        ScoreBody(const cv::Mat &numerator, const std::vector<double> &sums, int cols, cv::Size pattern, double norm, cv::Mat &scores)
+            : numerator(numerator), sums(sums), cols(cols), pattern(pattern), norm(norm), scores(scores) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int stride = (cols + 1) * 2;
+            const int h = pattern.height;
+            const int w = pattern.width;
+            const double n = (double)h * w;
+            for( int y=range.start; y<range.end; y++ )
+            {
+                const double *top = &sums[y * stride];
+                const double *bottom = &sums[(y + h) * stride];
+                const double *num = numerator.ptr<double>(y + h/2) + w/2;
+                double *s = scores.ptr<double>(y);
+                for( int x=0; x<scores.cols; x++ )
+                {
+                    int x0 = 2*x, x1 = 2*(x + w);
+                    double s1 = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+                    double s2 = bottom[x1 + 1] - bottom[x0 + 1] - top[x1 + 1] + top[x0 + 1];
+                    s[x] = Normalize(num[x], s1, s2, n, norm);
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &numerator;
+        const std::vector<double> &sums;
+        int cols;
+        cv::Size pattern;
+        double norm;
+        cv::Mat &scores;
+    };
+
+    // -CV_64F normalized cross-correlation of channel 0 of source with
+    //         pattern, score (y, x) is for the pattern placed with its top
+    //         left corner at (y, x), the map is (rows - h + 1) x
+    //         (cols - w + 1)
+    //     -the numerator is one forward transform of the image, a product
+    //             with the conjugate of the cached spectrum of the zero mean
+    //             pattern and one inverse transform
+    //     -the local energy comes from integral tables of I and I^2, built
+    //             in one pass
+    //     -directory is passed on to the kernel spectrum cache
+    template< typename T >
+    cv::Mat Scores(const cv::Mat &source, const cv::Mat &pattern, const char *directory = NULL)
+    {
+        CV_Assert(pattern.rows <= source.rows && pattern.cols <= source.cols);
+        double norm;
+        cv::Mat zero = ZeroMean<T>(pattern, norm);
+
+        // circular correlation is exact at every position the pattern fits,
+        //         so the transform needs no room beyond the image
+        Spectrum spectrum = FFT::Forward<T>(source, false);
+        FFT::Multiply(spectrum, FFT::KernelSpectrum(zero, spectrum.rows, spectrum.cols, false, directory), true);
+        Spectrum numerator = FFT::Inverse(spectrum);
+
+        std::vector<double> sums = Integral<T>(source);
+        cv::Mat scores(source.rows - pattern.rows + 1, source.cols - pattern.cols + 1, CV_64F);
+        cv::parallel_for_(cv::Range(0, scores.rows), ScoreBody(numerator.re, sums, source.cols, pattern.size(), norm, scores));
+        return scores;
+    }
+
+    // -3x3 local maxima of a CV_64F map over one stripe of rows per index
+    //         of range, each stripe keeps its cap strongest in a bounded
+    //         min-heap
+    class MaximaBody : public cv::ParallelLoopBody
+    {
+     public:
+        MaximaBody(const cv::Mat &map, int cap, int stripes, std::vector< std::vector<Filter::Peak> > &partial)
+            : map(map), cap(cap), stripes(stripes), partial(partial) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int rows = map.rows;
+            const int cols = map.cols;
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)rows * s / stripes);
+                int last = (int)((long long)rows * (s + 1) / stripes);
+                Filter::PeakHeap heap;
+                for( int y=first; y<last; y++ )
+                {
+                    const double *mid = map.ptr<double>(y);
+                    const double *up = y > 0 ? map.ptr<double>(y - 1) : NULL;
+                    const double *down = y + 1 < rows ? map.ptr<double>(y + 1) : NULL;
+                    for( int x=0; x<cols; x++ )
+                    {
+                        double v = mid[x];
+                        bool local = true;
+                        for( int dx=std::max(x - 1, 0); dx<=std::min(x + 1, cols - 1) && local; dx++ )
+                            local = (dx == x || v >= mid[dx]) && (!up || v >= up[dx]) && (!down || v >= down[dx]);
+                        if( !local )
+                            continue;
+                        if( (int)heap.size() < cap || v > heap.top().value )
+                        {
+                            Filter::Peak peak = {x, y, v};
+                            heap.push(peak);
+                            if( (int)heap.size() > cap )
+                                heap.pop();
+                        }
+                    }
+                }
+
+                partial[s].clear();
+                while( !heap.empty() )
+                {
+                    partial[s].push_back(heap.top());
+                    heap.pop();
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &map;
+        int cap;
+        int stripes;
+        std::vector< std::vector<Filter::Peak> > &partial;
+    };
+
+    // -strongest k local maxima of a score map, strongest first, merged from
+    //         per-thread bounded heaps
+    //     -non-maximum suppression keeps the strongest of any maxima closer
+    //             than radius
+    inline std::vector<Filter::Peak> Best(const cv::Mat &scores, int k, int radius)
+    {
+        CV_Assert(scores.type() == CV_64F);
+        std::vector<Filter::Peak> kept;
+        if( k <= 0 || scores.empty() )
+            return kept;
+
+        int stripes = std::max(1, std::min(cv::getNumThreads(), scores.rows));
+        int cap = 8*k + 16;
+        std::vector< std::vector<Filter::Peak> > partial(stripes);
+        cv::parallel_for_(cv::Range(0, stripes), MaximaBody(scores, cap, stripes, partial), stripes);
+
+        std::vector<Filter::Peak> candidates;
+        for( int s=0; s<stripes; s++ )
+            candidates.insert(candidates.end(), partial[s].begin(), partial[s].end());
+        std::sort(candidates.begin(), candidates.end(), Filter::PeakOrder);
+
+        for( size_t n=0; n<candidates.size() && (int)kept.size()<k; n++ )
+        {
+            const Filter::Peak &p = candidates[n];
+            bool clear = true;
+            for( size_t m=0; m<kept.size() && clear; m++ )
+            {
+                int dx = p.x - kept[m].x;
+                int dy = p.y - kept[m].y;
+                clear = dx*dx + dy*dy > radius*radius;
+            }
+            if( clear )
+                kept.push_back(p);
+        }
+        return kept;
+    }
+
+    // -top k matches of pattern in source, (x, y) the top left corner and
+    //         value the normalized cross-correlation in [-1, 1]
+    //     -matches closer than radius are suppressed, by default half the
+    //             smaller side of the pattern
+    //     -scoreMap, when given, is set to the full score map
+    template< typename T >
+    std::vector<Filter::Peak> Template(const cv::Mat &source, const cv::Mat &pattern, int k, int radius = -1, cv::Mat *scoreMap = NULL)
+    {
+        cv::Mat scores = Scores<T>(source, pattern);
+        if( scoreMap )
+            *scoreMap = scores;
+        if( radius < 0 )
+            radius = std::min(pattern.rows, pattern.cols) / 2;
+        return Best(scores, k, radius);
+    }
+
+    // -score of a zero mean pattern with its top left corner at (x, y) of
+    //         image, the numerator summed directly for the few positions
+    //         left to check after a coarse search
+    template< typename T >
+    double ScoreAt(const cv::Mat &image, const std::vector<double> &sums, const cv::Mat &zero, double norm, int x, int y)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int cn = image.channels();
+        const int h = zero.rows;
+        const int w = zero.cols;
+        double num = 0.0;
+        for( int i=0; i<h; i++ )
+        {
+            const C *p = image.ptr<C>(y + i) + x*cn;
+            const double *z = zero.ptr<double>(i);
+            for( int j=0; j<w; j++ )
+                num += p[j*cn] * z[j];
+        }
+
+        const int stride = (image.cols + 1) * 2;
+        const double *top = &sums[y * stride];
+        const double *bottom = &sums[(y + h) * stride];
+        int x0 = 2*x, x1 = 2*(x + w);
+        double s1 = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+        double s2 = bottom[x1 + 1] - bottom[x0 + 1] - top[x1 + 1] + top[x0 + 1];
+        return Normalize(num, s1, s2, (double)h * w, norm);
+    }
+
+    // -candidates of each pattern carried from one pyramid level to the
+    //         next finer one, one pattern per index of range
+    //     -a candidate at (x, y) is scored at every position within reach
+    //             of (2x, 2y) and moves to the best of them
+    template< typename T >
+    class RefineBody : public cv::ParallelLoopBody
+    {
+     public:
+        RefineBody(const cv::Mat &image, const std::vector<double> &sums, const std::vector< std::vector<cv::Mat> > &zeros,
+                const std::vector< std::vector<double> > &norms, int level, int reach, std::vector< std::vector<Filter::Peak> > &candidates)
+            : image(image), sums(sums), zeros(zeros), norms(norms), level(level), reach(reach), candidates(candidates) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            for( int n=range.start; n<range.end; n++ )
+            {
+                const cv::Mat &zero = zeros[n][level];
+                const int xmax = image.cols - zero.cols;
+                const int ymax = image.rows - zero.rows;
+                std::vector<Filter::Peak> &list = candidates[n];
+                if( xmax < 0 || ymax < 0 )
+                {
+                    list.clear();
+                    continue;
+                }
+
+                for( size_t k=0; k<list.size(); k++ )
+                {
+                    Filter::Peak best = {0, 0, -2.0};
+                    int cx = 2*list[k].x, cy = 2*list[k].y;
+                    for( int y=std::max(cy - reach, 0); y<=std::min(cy + reach, ymax); y++ )
+                        for( int x=std::max(cx - reach, 0); x<=std::min(cx + reach, xmax); x++ )
+                        {
+                            double v = ScoreAt<T>(image, sums, zero, norms[n][level], x, y);
+                            if( v > best.value )
+                            {
+                                Filter::Peak p = {x, y, v};
+                                best = p;
+                            }
+                        }
+                    if( best.value < -1.0 )
+                    {
+                        best.x = std::min(cx, xmax);
+                        best.y = std::min(cy, ymax);
+                        best.value = ScoreAt<T>(image, sums, zero, norms[n][level], best.x, best.y);
+                    }
+                    list[k] = best;
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &image;
+        const std::vector<double> &sums;
+        const std::vector< std::vector<cv::Mat> > &zeros;
+        const std::vector< std::vector<double> > &norms;
+        int level;
+        int reach;
+        std::vector< std::vector<Filter::Peak> > &candidates;
+    };
+
+
+    // Library class
+    // -patterns searched for together in every frame
+    // -each pattern keeps a pyramid of zero mean levels, the search starts
+    //         at the coarse level: at most levels halvings, and no pattern
+    //         smaller than minSize on its smaller side there
+    // -at the coarse level the patterns are held in pairs as one spectrum
+    //         conj K1 + i conj K2, so one product with the frame spectrum
+    //         and one inverse transform give the correlations of both in
+    //         the real and imaginary parts; the pair spectra are made for
+    //         the first frame of each transform size and kept
+    // -Search builds the frame pyramid and its integral tables once and
+    //         shares them, and the coarse frame spectrum, between all the
+    //         patterns
+    // -frames are real, a second channel is read as the imaginary part by
+    //         the transform and must be zero
+    template< typename T >
+    class Library {
+     public:
+        Library(int levels = 3, int minSize = 8);
+
+        void Add(const cv::Mat &pattern);
+        int Size() const;
+        int Coarse() const;
+        std::vector< std::vector<Filter::Peak> > Search(const cv::Mat &frame, int k, double threshold = 0.5, int reach = 2);
+
+     private:
+        const std::vector<Spectrum>& Pairs(int rows, int cols);
+
+        std::vector< std::vector<cv::Mat> > zeros;
+        std::vector< std::vector<double> > norms;
+        std::map< std::pair<int, int>, std::vector<Spectrum> > pairs;
+        int levels;
+        int minSize;
+    };
+
+    template< typename T >
+    inline Library<T>::Library(int levels, int minSize)
+        : levels(std::max(levels, 0)), minSize(std::max(minSize, 1))
+    {
+    }
+
+    // -zero mean levels 0 to levels of the pattern pyramid, made once
+    template< typename T >
+    inline void Library<T>::Add(const cv::Mat &pattern)
+    {
+        Pyramid<T> pyramid(pattern);
+        this->zeros.push_back(std::vector<cv::Mat>());
+        this->norms.push_back(std::vector<double>());
+        for( int l=0; l<=this->levels; l++ )
+        {
+            double norm;
+            this->zeros.back().push_back(ZeroMean<T>(pyramid.Level(l), norm));
+            this->norms.back().push_back(norm);
+        }
+        this->pairs.clear();
+    }
+
+    template< typename T >
+    inline int Library<T>::Size() const
+    {
+        return (int)this->zeros.size();
+    }
+
+    template< typename T >
+    inline int Library<T>::Coarse() const
+    {
+        int coarse = this->levels;
+        for( size_t n=0; n<this->zeros.size(); n++ )
+            while( coarse > 0 && std::min(this->zeros[n][coarse].rows, this->zeros[n][coarse].cols) < this->minSize )
+                coarse--;
+        return coarse;
+    }
+
+    // -conj K1 + i conj K2 for each pair of patterns at the coarse level,
+    //         a pattern larger than the transform contributes nothing
+    template< typename T >
+    inline const std::vector<Spectrum>& Library<T>::Pairs(int rows, int cols)
+    {
+        std::pair<int, int> key(rows, cols);
+        std::map< std::pair<int, int>, std::vector<Spectrum> >::iterator it = this->pairs.find(key);
+        if( it != this->pairs.end() )
+            return it->second;
+
+        const int coarse = Coarse();
+        std::vector<Spectrum> &list = this->pairs[key];
+        for( size_t n=0; n<this->zeros.size(); n+=2 )
+        {
+            Spectrum combined(rows, cols, false);
+            combined.re.setTo(cv::Scalar(0.0));
+            combined.im.setTo(cv::Scalar(0.0));
+            for( size_t m=n; m<n + 2 && m<this->zeros.size(); m++ )
+            {
+                const cv::Mat &zero = this->zeros[m][coarse];
+                if( zero.rows > rows || zero.cols > cols )
+                    continue;
+                Spectrum kernel = FFT::KernelTransform(zero, rows, cols, false);
+                const bool second = m > n;
+                for( int i=0; i<rows; i++ )
+                {
+                    const double *kr = kernel.re.ptr<double>(i);
+                    const double *ki = kernel.im.ptr<double>(i);
+                    double *a = combined.re.ptr<double>(i);
+                    double *b = combined.im.ptr<double>(i);
+                    for( int j=0; j<cols; j++ )
+                    {
+                        a[j] += second ? ki[j] : kr[j];
+                        b[j] += second ? kr[j] : -ki[j];
+                    }
+                }
+            }
+            list.push_back(combined);
+        }
+        return list;
+    }
+
+    // -top k matches of every pattern in frame, result[n] for pattern n
+    //         with (x, y) the top left corner and value the normalized
+    //         cross-correlation
+    //     -the coarse level is searched exhaustively and keeps 4k candidates
+    //             per pattern, each finer level only scores the positions
+    //             within reach of a candidate
+    //     -matches below threshold and matches closer than half the smaller
+    //             side of their pattern to a better one are dropped
+    template< typename T >
+    std::vector< std::vector<Filter::Peak> > Library<T>::Search(const cv::Mat &frame, int k, double threshold, int reach)
+    {
+        const int count = Size();
+        const int coarse = Coarse();
+        std::vector< std::vector<Filter::Peak> > candidates(count);
+        if( count == 0 || k <= 0 )
+            return candidates;
+
+        Pyramid<T> pyramid(frame);
+        std::vector< std::vector<double> > sums(coarse + 1);
+        for( int l=0; l<=coarse; l++ )
+            sums[l] = Integral<T>(pyramid.Level(l));
+
+        const cv::Mat &top = pyramid.Level(coarse);
+        Spectrum spectrum = FFT::Forward<T>(top, false);
+        const std::vector<Spectrum> &spectra = Pairs(spectrum.rows, spectrum.cols);
+        Spectrum z(spectrum.rows, spectrum.cols, false);
+        for( size_t p=0; p<spectra.size(); p++ )
+        {
+            spectrum.re.copyTo(z.re);
+            spectrum.im.copyTo(z.im);
+            FFT::Multiply(z, spectra[p]);
+            FFT::Transform(z, 1);
+
+            for( int n=2*(int)p; n<std::min(2*(int)p + 2, count); n++ )
+            {
+                const bool half = n > 2*(int)p;
+                const cv::Mat &zero = this->zeros[n][coarse];
+                if( zero.rows > top.rows || zero.cols > top.cols )
+                    continue;
+                cv::Mat scores(top.rows - zero.rows + 1, top.cols - zero.cols + 1, CV_64F);
+                cv::parallel_for_(cv::Range(0, scores.rows), ScoreBody(half ? z.im : z.re, sums[coarse], top.cols, zero.size(), this->norms[n][coarse], scores));
+                candidates[n] = Best(scores, 4*k, std::max(1, std::min(zero.rows, zero.cols) / 2));
+            }
+        }
+
+        for( int l=coarse - 1; l>=0; l-- )
+            cv::parallel_for_(cv::Range(0, count), RefineBody<T>(pyramid.Level(l), sums[l], this->zeros, this->norms, l, reach, candidates));
+
+        std::vector< std::vector<Filter::Peak> > result(count);
+        for( int n=0; n<count; n++ )
+        {
+            std::vector<Filter::Peak> &list = candidates[n];
+            std::sort(list.begin(), list.end(), Filter::PeakOrder);
+            const int radius = std::min(this->zeros[n][0].rows, this->zeros[n][0].cols) / 2;
+            for( size_t m=0; m<list.size() && (int)result[n].size()<k; m++ )
+            {
+                const Filter::Peak &p = list[m];
+                bool clear = p.value >= threshold;
+                for( size_t q=0; q<result[n].size() && clear; q++ )
+                {
+                    int dx = p.x - result[n][q].x;
+                    int dy = p.y - result[n][q].y;
+                    clear = dx*dx + dy*dy > radius*radius;
+                }
+                if( clear )
+                    result[n].push_back(p);
+            }
+        }
+        return result;
+    }
+}
+
+#endif
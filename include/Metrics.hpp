@@ -0,0 +1,347 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Metrics
+{
+    // Errors
+    // -sums of the differences between two images over every element
+    struct Errors
+    {
+        double sse;
+        double sae;
+        double maxAbs;
+        double count;
+    };
+
+    // -add the squared and absolute errors of one row to sse and sae and
+    //         fold its largest absolute error into mx
+    //     -differences are taken in the work type W of T and summed in
+    //             doubles, two accumulators keep the adds independent
+    //     -m, when not NULL, receives the squared error of every element
+    template< typename T, typename W >
+    inline void RowErrors(const T *a, const T *b, int width, double *m, double &sse, double &sae, W &mx)
+    {
+        double sq0 = 0.0, sq1 = 0.0, ab0 = 0.0, ab1 = 0.0;
+        int j = 0;
+        for( ; j<=width - 2; j+=2 )
+        {
+            W d0 = (W)a[j] - (W)b[j];
+            W d1 = (W)a[j+1] - (W)b[j+1];
+            W q0 = d0 < 0 ? -d0 : d0;
+            W q1 = d1 < 0 ? -d1 : d1;
+            sq0 += (double)d0 * d0;
+            sq1 += (double)d1 * d1;
+            ab0 += q0;
+            ab1 += q1;
+            mx = std::max(mx, std::max(q0, q1));
+            if( m )
+            {
+                m[j] = (double)d0 * d0;
+                m[j+1] = (double)d1 * d1;
+            }
+        }
+        for( ; j<width; j++ )
+        {
+            W d0 = (W)a[j] - (W)b[j];
+            W q0 = d0 < 0 ? -d0 : d0;
+            sq0 += (double)d0 * d0;
+            ab0 += q0;
+            mx = std::max(mx, q0);
+            if( m )
+                m[j] = (double)d0 * d0;
+        }
+        sse += sq0 + sq1;
+        sae += ab0 + ab1;
+    }
+
+#if defined(__SSE2__)
+    // -SSE2 (always there on x86-64), 16 elements per step
+    //     -|a - b| from two saturating subtracts, its sum from psadbw and
+    //             its squares from pmaddwd on the widened halves
+    //     -the 32 bit square sums are moved to doubles every 1024 steps,
+    //             well before they could overflow
+    //     -rows with an error map go through the scalar loop
+    inline void RowErrors(const uchar *a, const uchar *b, int width, double *m, double &sse, double &sae, int &mx)
+    {
+        if( m || width < 16 )
+        {
+            RowErrors<uchar, int>(a, b, width, m, sse, sae, mx);
+            return;
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+        __m128i vmx = zero, vab = zero;
+        int j = 0;
+        while( j <= width - 16 )
+        {
+            __m128i vsq = zero;
+            for( int n=0; n<1024 && j<=width - 16; n++, j+=16 )
+            {
+                __m128i va = _mm_loadu_si128((const __m128i*)(a + j));
+                __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                vmx = _mm_max_epu8(vmx, d);
+                vab = _mm_add_epi64(vab, _mm_sad_epu8(d, zero));
+                __m128i lo = _mm_unpacklo_epi8(d, zero);
+                __m128i hi = _mm_unpackhi_epi8(d, zero);
+                vsq = _mm_add_epi32(vsq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            }
+            int q[4];
+            _mm_storeu_si128((__m128i*)q, vsq);
+            sse += (double)q[0] + q[1] + q[2] + q[3];
+        }
+
+        long long t[2];
+        uchar u[16];
+        _mm_storeu_si128((__m128i*)t, vab);
+        _mm_storeu_si128((__m128i*)u, vmx);
+        sae += (double)(t[0] + t[1]);
+        for( int k=0; k<16; k++ )
+            mx = std::max(mx, (int)u[k]);
+        RowErrors<uchar, int>(a + j, b + j, width - j, NULL, sse, sae, mx);
+    }
+
+    // -two doubles per step, |a - b| by clearing the sign bit
+    inline void RowErrors(const double *a, const double *b, int width, double *m, double &sse, double &sae, double &mx)
+    {
+        const __m128d sign = _mm_set1_pd(-0.0);
+        __m128d vsq = _mm_setzero_pd(), vab = _mm_setzero_pd(), vmx = _mm_setzero_pd();
+        int j = 0;
+        for( ; j<=width - 2; j+=2 )
+        {
+            __m128d d = _mm_sub_pd(_mm_loadu_pd(a + j), _mm_loadu_pd(b + j));
+            __m128d q = _mm_andnot_pd(sign, d);
+            __m128d d2 = _mm_mul_pd(d, d);
+            vsq = _mm_add_pd(vsq, d2);
+            vab = _mm_add_pd(vab, q);
+            vmx = _mm_max_pd(vmx, q);
+            if( m )
+                _mm_storeu_pd(m + j, d2);
+        }
+
+        double v[2];
+        _mm_storeu_pd(v, vsq);
+        sse += v[0] + v[1];
+        _mm_storeu_pd(v, vab);
+        sae += v[0] + v[1];
+        _mm_storeu_pd(v, vmx);
+        mx = std::max(mx, std::max(v[0], v[1]));
+        RowErrors<double, double>(a + j, b + j, width - j, m ? m + j : NULL, sse, sae, mx);
+    }
+#endif
+
+    // -reduce one stripe of rows per index of range into its own Errors
+    //     -map, when not empty, receives the squared error of every element
+    template< typename T >
+    class ErrorBody : public cv::ParallelLoopBody
+    {
+     public:
+        ErrorBody(const cv::Mat &source, const cv::Mat &compare, cv::Mat &map, int stripes, std::vector<Errors> &partial)
+            : source(source), compare(compare), map(map), stripes(stripes), partial(partial) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::work_type W;
+            const int width = source.cols * source.channels();
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)source.rows * s / stripes);
+                int last = (int)((long long)source.rows * (s + 1) / stripes);
+                Errors e = {0.0, 0.0, 0.0, 0.0};
+                W mx = 0;
+                for( int i=first; i<last; i++ )
+                {
+                    double *m = map.empty() ? NULL : map.ptr<double>(i);
+                    RowErrors(source.ptr<T>(i), compare.ptr<T>(i), width, m, e.sse, e.sae, mx);
+                }
+                e.maxAbs = (double)mx;
+                e.count = (double)(last - first) * width;
+                partial[s] = e;
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        const cv::Mat &compare;
+        cv::Mat &map;
+        int stripes;
+        std::vector<Errors> &partial;
+    };
+
+    // -compare two images of the same size and type element by element
+    //     -one stripe of rows per thread, partials merged in stripe order so
+    //             the result does not depend on scheduling
+    //     -errorMap, when given, is set to the CV_64F squared error of every
+    //             element with the channels of source
+    template< typename T >
+    Errors Compare(const cv::Mat &source, const cv::Mat &compare, cv::Mat *errorMap = NULL)
+    {
+        CV_Assert(source.size() == compare.size() && source.type() == compare.type());
+        cv::Mat map;
+        if( errorMap )
+        {
+            errorMap->create(source.rows, source.cols, CV_64FC(source.channels()));
+            map = *errorMap;
+        }
+
+        Errors total = {0.0, 0.0, 0.0, 0.0};
+        if( source.empty() )
+            return total;
+
+        int stripes = std::max(1, std::min(cv::getNumThreads(), source.rows));
+        std::vector<Errors> partial(stripes);
+        cv::parallel_for_(cv::Range(0, stripes), ErrorBody<T>(source, compare, map, stripes, partial), stripes);
+        for( int s=0; s<stripes; s++ )
+        {
+            total.sse += partial[s].sse;
+            total.sae += partial[s].sae;
+            total.maxAbs = std::max(total.maxAbs, partial[s].maxAbs);
+            total.count += partial[s].count;
+        }
+        return total;
+    }
+
+    template< typename T >
+    double MSE(const cv::Mat &source, const cv::Mat &compare, cv::Mat *errorMap = NULL)
+    {
+        Errors e = Compare<T>(source, compare, errorMap);
+        return e.count > 0 ? e.sse / e.count : 0.0;
+    }
+
+    // -10 log10(peak^2 / MSE), infinite for identical images
+    template< typename T >
+    double PSNR(const cv::Mat &source, const cv::Mat &compare, double peak = 255.0)
+    {
+        double mse = MSE<T>(source, compare);
+        return mse > 0.0 ? 10.0 * log10(peak * peak / mse) : DBL_MAX;
+    }
+
+    template< typename T >
+    double MAE(const cv::Mat &source, const cv::Mat &compare)
+    {
+        Errors e = Compare<T>(source, compare);
+        return e.count > 0 ? e.sae / e.count : 0.0;
+    }
+
+    template< typename T >
+    double MaxAbs(const cv::Mat &source, const cv::Mat &compare)
+    {
+        return Compare<T>(source, compare).maxAbs;
+    }
+
+    // -SSIM of every pixel from the (2*radius + 1) square window around
+    //         it (clipped to the image), window sums read from integral
+    //         tables of a, b, a^2, b^2 and ab
+    class SSIMBody : public cv::ParallelLoopBody
+    {
+     public:
+        SSIMBody(const std::vector<double> &sums, int rows, int cols, int radius, double c1, double c2, cv::Mat &map, std::vector<double> &rowSum)
+            : sums(sums), rows(rows), cols(cols), radius(radius), c1(c1), c2(c2), map(map), rowSum(rowSum) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int stride = (cols + 1) * 5;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                int y0 = std::max(i - radius, 0);
+                int y1 = std::min(i + radius + 1, rows);
+                const double *top = &sums[y0 * stride];
+                const double *bottom = &sums[y1 * stride];
+                double *m = map.empty() ? NULL : map.ptr<double>(i);
+                double total = 0.0;
+                for( int j=0; j<cols; j++ )
+                {
+                    int x0 = std::max(j - radius, 0) * 5;
+                    int x1 = std::min(j + radius + 1, cols) * 5;
+                    double n = (double)(y1 - y0) * (x1 - x0) / 5;
+                    double w[5];
+                    for( int k=0; k<5; k++ )
+                        w[k] = (bottom[x1 + k] - bottom[x0 + k] - top[x1 + k] + top[x0 + k]) / n;
+
+                    double va = w[2] - w[0]*w[0];
+                    double vb = w[3] - w[1]*w[1];
+                    double cov = w[4] - w[0]*w[1];
+                    double ssim = ((2.0*w[0]*w[1] + c1) * (2.0*cov + c2))
+                            / ((w[0]*w[0] + w[1]*w[1] + c1) * (va + vb + c2));
+                    if( m )
+                        m[j] = ssim;
+                    total += ssim;
+                }
+                rowSum[i] = total;
+            }
+        }
+
+     private:
+        const std::vector<double> &sums;
+        int rows, cols, radius;
+        double c1, c2;
+        cv::Mat &map;
+        std::vector<double> &rowSum;
+    };
+
+    // -mean structural similarity of one channel of two images
+    //     -one pass builds interleaved integral tables of a, b, a^2, b^2
+    //             and ab so every window costs the same whatever its size
+    //     -c1 = (0.01 peak)^2, c2 = (0.03 peak)^2
+    //     -ssimMap, when given, is set to the CV_64F SSIM of every pixel
+    template< typename T >
+    double SSIM(const cv::Mat &source, const cv::Mat &compare, int channel = 0, int radius = 3, double peak = 255.0, cv::Mat *ssimMap = NULL)
+    {
+        CV_Assert(source.size() == compare.size() && source.type() == compare.type());
+        const int rows = source.rows;
+        const int cols = source.cols;
+        const int cn = source.channels();
+        const int stride = (cols + 1) * 5;
+        if( rows == 0 || cols == 0 )
+            return 1.0;
+
+        std::vector<double> sums((rows + 1) * stride, 0.0);
+        for( int i=0; i<rows; i++ )
+        {
+            const T *a = source.ptr<T>(i) + channel;
+            const T *b = compare.ptr<T>(i) + channel;
+            const double *up = &sums[i * stride];
+            double *d = &sums[(i + 1) * stride];
+            double run[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+            for( int j=0; j<cols; j++ )
+            {
+                double va = a[j*cn];
+                double vb = b[j*cn];
+                run[0] += va;
+                run[1] += vb;
+                run[2] += va * va;
+                run[3] += vb * vb;
+                run[4] += va * vb;
+                for( int k=0; k<5; k++ )
+                    d[(j + 1)*5 + k] = up[(j + 1)*5 + k] + run[k];
+            }
+        }
+
+        cv::Mat map;
+        if( ssimMap )
+        {
+            ssimMap->create(rows, cols, CV_64F);
+            map = *ssimMap;
+        }
+        std::vector<double> rowSum(rows, 0.0);
+        double c1 = (0.01 * peak) * (0.01 * peak);
+        double c2 = (0.03 * peak) * (0.03 * peak);
+        cv::parallel_for_(cv::Range(0, rows), SSIMBody(sums, rows, cols, std::max(radius, 0), c1, c2, map, rowSum));
+
+        double total = 0.0;
+        for( int i=0; i<rows; i++ )
+            total += rowSum[i];
+        return total / ((double)rows * cols);
+    }
+}
+
+#endif
@@ -1,23 +1,52 @@
 #ifndef NOISE_H
 #define NOISE_H
 
+#include "Random.hpp"
+
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include <vector>
 
 namespace Noise
 {
+    // -salt and pepper over a band of rows, one random word per pixel keyed
+    //         by its index: the top bits decide whether it is hit and the
+    //         lowest bit whether it turns white or black
     template< typename T >
-    void SaltandPepper(cv::Mat& source, int percentage)
+    class SaltandPepperBody : public cv::ParallelLoopBody
     {
-        if( percentage == 0 )
-            return;
+     public:
+        SaltandPepperBody(cv::Mat &source, int percentage, Random::Word seed)
+            : source(source), percentage(percentage), seed(seed) {}
 
-        for(int i=0; i<source.rows; i++)
-            for(int j=0; j<source.cols; j++)
+        void operator()(const cv::Range &range) const
+        {
+            std::vector<Random::Word> block(source.cols);
+            for( int i=range.start; i<range.end; i++ )
             {
-                if((rand() % 100) < percentage)
-                    source.at<T>(i, j) = (uchar)(rand() % 2) * 255;
+                Random::Fill(seed, (Random::Word)i * source.cols, source.cols, &block[0]);
+                T *p = source.ptr<T>(i);
+                for( int j=0; j<source.cols; j++ )
+                    if( (int)Random::Below(block[j], 100) < percentage )
+                        p[j] = (uchar)(block[j] & 1) * 255;
             }
+        }
+
+     private:
+        cv::Mat &source;
+        int percentage;
+        Random::Word seed;
+    };
+
+    // -replace percentage % of the pixels with 0 or 255
+    //     -the same seed gives the same image on any number of threads
+    template< typename T >
+    void SaltandPepper(cv::Mat& source, int percentage, Random::Word seed = 0)
+    {
+        if( percentage == 0 )
+            return;
+
+        cv::parallel_for_(cv::Range(0, source.rows), SaltandPepperBody<T>(source, percentage, seed));
     }
 
     template< typename T>
@@ -28,47 +57,77 @@ namespace Noise
                 source.at<T>(i, j) *= (*h)(a, b, t, i, j);
     }
 
-    extern double ranf();         /* ranf() is uniform in 0..1 */
-    //(c) Copyright 1994, Everett F. Carter Jr.
-    double BoxMuller(double m, double s)	/* normal random variate generator */
-    {				        /* mean m, standard deviation s */
-	    double x1, x2, w, y1;
-	    static double y2;
-	    static int use_last = 0;
-
-	    if (use_last)		        /* use value from previous call */
-	    {
-		    y1 = y2;
-		    use_last = 0;
-	    }
-	    else
-	    {
-		    do {
-			    x1 = 2.0 * ranf() - 1.0;
-			    x2 = 2.0 * ranf() - 1.0;
-			    w = x1 * x1 + x2 * x2;
-		    } while ( w >= 1.0 );
-
-		    w = sqrt( (-2.0 * log( w ) ) / w );
-		    y1 = x1 * w;
-		    y2 = x2 * w;
-		    use_last = 1;
-	    }
-
-	    return( m + y1 * s );
+    // -normal variate with mean m and deviation s for element index of
+    //         the stream seed, nothing is kept between calls
+    //     -elements 2q and 2q+1 share the pair of uniforms of q (basic
+    //             Box-Muller, no rejection loop) and take its cosine and
+    //             sine halves
+    inline double BoxMuller(double m, double s, Random::Word seed, Random::Word index)
+    {
+        Random::Word q = index >> 1;
+        double u1 = 1.0 - Random::Uniform(seed, 2*q);
+        double u2 = Random::Uniform(seed, 2*q + 1);
+        double r = sqrt(-2.0 * log(u1));
+        double theta = 2.0 * M_PI * u2;
+        return m + s * r * ((index & 1) ? sin(theta) : cos(theta));
     }
 
+    // -add N(mu, sigma) to a band of rows
+    //     -the uniforms for a whole row are made in one block, then one log,
+    //             sqrt and sine/cosine per pair of elements
+    //     -results saturate to the channel type
+    template< typename T >
+    class GaussianBody : public cv::ParallelLoopBody
+    {
+     public:
+        GaussianBody(cv::Mat &source, double mu, double sigma, Random::Word seed)
+            : source(source), mu(mu), sigma(sigma), seed(seed) {}
 
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            const int width = source.cols * source.channels();
+            std::vector<Random::Word> block(2 * (width / 2 + 2));
+            std::vector<double> noise(2 * (width / 2 + 2));
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                Random::Word first = (Random::Word)i * width;
+                Random::Word q0 = first >> 1;
+                Random::Word q1 = (first + width - 1) >> 1;
+                int pairs = (int)(q1 - q0 + 1);
+                Random::Fill(seed, 2*q0, 2*pairs, &block[0]);
+
+                for( int k=0; k<pairs; k++ )
+                {
+                    double u1 = 1.0 - (block[2*k] >> 11) * (1.0 / 9007199254740992.0);
+                    double u2 = (block[2*k + 1] >> 11) * (1.0 / 9007199254740992.0);
+                    double r = sigma * sqrt(-2.0 * log(u1));
+                    double theta = 2.0 * M_PI * u2;
+                    noise[2*k] = mu + r * cos(theta);
+                    noise[2*k + 1] = mu + r * sin(theta);
+                }
+
+                C *p = source.ptr<C>(i);
+                const double *n = &noise[first & 1];
+                for( int j=0; j<width; j++ )
+                    p[j] = cv::saturate_cast<C>(p[j] + n[j]);
+            }
+        }
+
+     private:
+        cv::Mat &source;
+        double mu, sigma;
+        Random::Word seed;
+    };
+
+    // -add gaussian noise N(mu, sigma) to every element
+    //     -the same seed gives the same image on any number of threads
     template< typename T>
-    void Gaussian(cv::Mat& source, double mu, double sigma)
+    void Gaussian(cv::Mat& source, double mu, double sigma, Random::Word seed = 0)
     {
-        for(int i=0; i<source.rows; i++)
-            for(int j=0; j<source.cols; j++)
-                source.at<T>(i, j) += mu + sigma*Noise::BoxMuller(mu, sigma);
+        cv::parallel_for_(cv::Range(0, source.rows), GaussianBody<T>(source, mu, sigma, seed));
     }
-    
-
-
 
 }
 
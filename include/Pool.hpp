@@ -0,0 +1,219 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+
+// Pool class
+// -recycles scratch and output buffers so repeated frames stop going to
+//         the heap
+// -buffers are grouped in power of two size classes, Acquire hands out a
+//         Mat header over a free buffer of the class (or allocates one)
+//         and Release returns it
+// -blocks is sorted by address so the block behind any Mat, ROIs
+//         included, is found by binary search, and each free list is
+//         reserved to the number of blocks, so once every class has been
+//         used Acquire and Release allocate nothing
+// -the pool owns the memory, a Mat must be released before the pool dies
+//         and must not be used after it is released
+// -a block holds at most INT_MAX bytes
+// -with a pool and after one warm-up call per size, these take nothing
+//         from the heap themselves: Warp (all but the pyramid branch,
+//         which builds its list of levels), Resample::Resize,
+//         Shear::Rotate, Filter::Correlation, Filter::Median,
+//         FFT::FFT2D, FFT::Forward, FFT::Inverse, FFT::Transform,
+//         Util::Magnitude and Util::MinMax
+//     -FFT::Convolve still copies the cached kernel spectrum
+//     -parallel_for_ may allocate inside the threading backend
+class Pool {
+ public:
+    struct Stats
+    {
+        size_t hits;
+        size_t misses;
+        size_t bytes;
+        size_t inUse;
+        size_t highWater;
+    };
+
+    Pool(size_t minBytes = 4096);
+    ~Pool();
+
+    cv::Mat Acquire(int rows, int cols, int type);
+    void Release(cv::Mat&);
+    Stats Statistics() const;
+    void Trim();
+
+ private:
+    struct Block
+    {
+        uchar *start;
+        uchar *end;
+        int k;
+        bool used;
+        cv::Mat data;
+    };
+
+    Pool(const Pool&);
+    Pool& operator=(const Pool&);
+
+    int Class(size_t bytes) const;
+    Block* Find(const uchar *p);
+    static bool Before(const uchar *p, const Block &b);
+    static bool Unused(const Block &b);
+
+    std::vector<Block> blocks;
+    std::vector< std::vector<uchar*> > free;
+    Stats stats;
+    size_t minBytes;
+    mutable cv::Mutex lock;
+};
+
+inline Pool::Pool(size_t minBytes)
+    : minBytes(minBytes)
+{
+    this->stats.hits = 0;
+    this->stats.misses = 0;
+    this->stats.bytes = 0;
+    this->stats.inUse = 0;
+    this->stats.highWater = 0;
+}
+
+inline Pool::~Pool()
+{
+}
+
+// -smallest class k with minBytes * 2^k >= bytes
+inline int Pool::Class(size_t bytes) const
+{
+    CV_Assert(bytes <= (size_t)INT_MAX);
+    int k = 0;
+    size_t size = this->minBytes;
+    while( size < bytes )
+    {
+        size <<= 1;
+        k++;
+    }
+    CV_Assert(size <= (size_t)INT_MAX);
+    return k;
+}
+
+inline bool Pool::Before(const uchar *p, const Block &b)
+{
+    return p < b.start;
+}
+
+inline bool Pool::Unused(const Block &b)
+{
+    return !b.used;
+}
+
+// -block holding p, NULL when p is not in the pool
+inline Pool::Block* Pool::Find(const uchar *p)
+{
+    std::vector<Block>::iterator it = std::upper_bound(this->blocks.begin(), this->blocks.end(), p, Before);
+    if( it == this->blocks.begin() )
+        return NULL;
+    --it;
+    return p < it->end ? &*it : NULL;
+}
+
+inline cv::Mat Pool::Acquire(int rows, int cols, int type)
+{
+    size_t bytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+    int k = Class(bytes);
+    size_t size = this->minBytes << k;
+
+    cv::AutoLock guard(this->lock);
+    if( (int)this->free.size() <= k )
+        this->free.resize(k + 1);
+
+    uchar *start;
+    if( this->free[k].empty() )
+    {
+        Block block;
+        block.data = cv::Mat(1, (int)size, CV_8U);
+        block.start = block.data.data;
+        block.end = block.start + size;
+        block.k = k;
+        block.used = false;
+        this->blocks.insert(std::upper_bound(this->blocks.begin(), this->blocks.end(), block.start, Before), block);
+        this->free[k].reserve(this->blocks.size());
+        start = block.start;
+        this->stats.misses++;
+        this->stats.bytes += size;
+    }
+    else
+    {
+        start = this->free[k].back();
+        this->free[k].pop_back();
+        this->stats.hits++;
+    }
+
+    Find(start)->used = true;
+    this->stats.inUse += size;
+    this->stats.highWater = std::max(this->stats.highWater, this->stats.inUse);
+    return cv::Mat(rows, cols, type, start);
+}
+
+// -give the block behind m back to its class and empty m, m may be any
+//         header or ROI over the block, a Mat that did not come from the
+//         pool is just released
+inline void Pool::Release(cv::Mat &m)
+{
+    if( m.data )
+    {
+        cv::AutoLock guard(this->lock);
+        Block *block = Find(m.data);
+        if( block )
+        {
+            CV_Assert(block->used);
+            block->used = false;
+            this->free[block->k].push_back(block->start);
+            this->stats.inUse -= this->minBytes << block->k;
+        }
+    }
+    m.release();
+}
+
+inline Pool::Stats Pool::Statistics() const
+{
+    cv::AutoLock guard(this->lock);
+    return this->stats;
+}
+
+// -free every buffer not currently handed out
+inline void Pool::Trim()
+{
+    cv::AutoLock guard(this->lock);
+    for( size_t k=0; k<this->free.size(); k++ )
+    {
+        this->stats.bytes -= this->free[k].size() * (this->minBytes << k);
+        this->free[k].clear();
+    }
+    this->blocks.erase(std::remove_if(this->blocks.begin(), this->blocks.end(), Unused), this->blocks.end());
+}
+
+
+// -functions taking an optional Pool* draw their scratch through these,
+//         without a pool they allocate and free as before
+namespace Buffer
+{
+    inline cv::Mat Acquire(Pool *pool, int rows, int cols, int type)
+    {
+        return pool ? pool->Acquire(rows, cols, type) : cv::Mat(rows, cols, type);
+    }
+
+    inline void Release(Pool *pool, cv::Mat &m)
+    {
+        if( pool )
+            pool->Release(m);
+        else
+            m.release();
+    }
+}
+
+#endif
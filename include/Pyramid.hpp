@@ -0,0 +1,222 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "Interpolate.hpp"
+#include "Pool.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+enum ReduceType {REDUCE2X2 = 0, REDUCE5TAP = 1};
+
+
+// Pyramid class
+// -holds successively halved copies of a source image
+// -level 0 is the source, levels are only reduced when first asked for
+//         so one pyramid can serve many output scales
+// -with a pool the reduced levels come from it and go back to it when the
+//         pyramid dies, such a pyramid must not be copied
+template< typename T >
+class Pyramid {
+ public:
+    Pyramid(const cv::Mat& m = cv::Mat(), ReduceType = REDUCE5TAP, Pool *pool = NULL);
+    ~Pyramid();
+
+    int Depth() const;
+    const cv::Mat& Level(int);
+    double LevelFor(double scale) const;
+    double Sample(double x, double y, double level, InterpolateType type, int channel = 0);
+
+    std::vector<cv::Mat> levels;
+    ReduceType reduce;
+    Pool *pool;
+
+ private:
+    void Reduce(const cv::Mat&, cv::Mat&) const;
+    double Bilinear(const cv::Mat&, double x, double y, int channel) const;
+};
+
+template< typename T >
+Pyramid<T>::Pyramid(const cv::Mat &source, ReduceType reduce, Pool *pool)
+{
+    this->levels.push_back(source);
+    this->reduce = reduce;
+    this->pool = pool;
+}
+
+template< typename T >
+Pyramid<T>::~Pyramid()
+{
+    for( size_t k=1; k<this->levels.size(); k++ )
+        Buffer::Release(this->pool, this->levels[k]);
+}
+
+// -number of levels down to a single pixel
+template< typename T >
+int Pyramid<T>::Depth() const
+{
+    int size = std::max(this->levels[0].rows, this->levels[0].cols);
+    int depth = 1;
+    while( size > 1 )
+    {
+        size = (size + 1) / 2;
+        depth++;
+    }
+    return depth;
+}
+
+// -reduce every missing level up to the one asked for
+template< typename T >
+const cv::Mat& Pyramid<T>::Level(int level)
+{
+    level = std::min(std::max(level, 0), Depth() - 1);
+    while( (int)this->levels.size() <= level )
+    {
+        const cv::Mat &last = this->levels.back();
+        cv::Mat next = Buffer::Acquire(this->pool, (last.rows + 1) / 2, (last.cols + 1) / 2, last.type());
+        Reduce(last, next);
+        this->levels.push_back(next);
+    }
+    return this->levels[level];
+}
+
+// -fractional level for a footprint of scale source pixels per sample
+template< typename T >
+double Pyramid<T>::LevelFor(double scale) const
+{
+    if( scale <= 1.0 )
+        return 0.0;
+    return std::min(log(scale) / log(2.0), (double)(Depth() - 1));
+}
+
+// -REDUCE2X2 averages each 2x2 block
+// -REDUCE5TAP smooths with the separable binomial [1 4 6 4 1]/16 and
+//         keeps every second sample, rows filtered once into a buffer
+//         (from pool when given)
+// -edges are replicated
+template< typename T >
+void Pyramid<T>::Reduce(const cv::Mat &source, cv::Mat &dest) const
+{
+    typedef typename cv::DataType<T>::channel_type C;
+    typedef typename cv::DataType<C>::work_type W;
+    const int cn = source.channels();
+    dest.create((source.rows + 1) / 2, (source.cols + 1) / 2, source.type());
+
+    if( this->reduce == REDUCE2X2 )
+    {
+        for( int i=0; i<dest.rows; i++ )
+        {
+            const C *s0 = source.ptr<C>(2*i);
+            const C *s1 = source.ptr<C>(std::min(2*i + 1, source.rows - 1));
+            C *d = dest.ptr<C>(i);
+            for( int j=0; j<dest.cols; j++ )
+            {
+                int x0 = 2*j*cn;
+                int x1 = std::min(2*j + 1, source.cols - 1)*cn;
+                for( int k=0; k<cn; k++ )
+                    d[j*cn + k] = cv::saturate_cast<C>(((W)s0[x0 + k] + s0[x1 + k] + s1[x0 + k] + s1[x1 + k]) * 0.25);
+            }
+        }
+        return;
+    }
+
+    static const int weights[5] = {1, 4, 6, 4, 1};
+    cv::Mat buffer = Buffer::Acquire(this->pool, source.rows, dest.cols * cn, cv::DataType<W>::type);
+    W *rows = buffer.ptr<W>(0);
+    for( int i=0; i<source.rows; i++ )
+    {
+        const C *s = source.ptr<C>(i);
+        W *r = &rows[i * dest.cols * cn];
+        for( int j=0; j<dest.cols; j++ )
+            for( int k=0; k<cn; k++ )
+            {
+                W sum = 0;
+                for( int t=0; t<5; t++ )
+                {
+                    int x = std::min(std::max(2*j + t - 2, 0), source.cols - 1);
+                    sum += weights[t] * s[x*cn + k];
+                }
+                r[j*cn + k] = sum;
+            }
+    }
+
+    const int width = dest.cols * cn;
+    for( int i=0; i<dest.rows; i++ )
+    {
+        C *d = dest.ptr<C>(i);
+        for( int j=0; j<width; j++ )
+        {
+            W sum = 0;
+            for( int t=0; t<5; t++ )
+            {
+                int y = std::min(std::max(2*i + t - 2, 0), source.rows - 1);
+                sum += weights[t] * rows[y*width + j];
+            }
+            d[j] = cv::saturate_cast<C>(sum * (1.0/256.0));
+        }
+    }
+    Buffer::Release(this->pool, buffer);
+}
+
+template< typename T >
+double Pyramid<T>::Bilinear(const cv::Mat &m, double x, double y, int channel) const
+{
+    typedef typename cv::DataType<T>::channel_type C;
+    const int cn = m.channels();
+    x = std::min(std::max(x, 0.0), m.cols - 1.0);
+    y = std::min(std::max(y, 0.0), m.rows - 1.0);
+    int x0 = (int)x;
+    int y0 = (int)y;
+    int x1 = std::min(x0 + 1, m.cols - 1);
+    int y1 = std::min(y0 + 1, m.rows - 1);
+    double fx = x - x0;
+    double fy = y - y0;
+    const C *r0 = m.ptr<C>(y0);
+    const C *r1 = m.ptr<C>(y1);
+    double top = r0[x0*cn + channel] + fx*(r0[x1*cn + channel] - r0[x0*cn + channel]);
+    double bottom = r1[x0*cn + channel] + fx*(r1[x1*cn + channel] - r1[x0*cn + channel]);
+    return top + fy*(bottom - top);
+}
+
+// -sample at level-0 location (x, y) from the given fractional level
+//     -map the location into the level's grid (sample k of a 2x2 level
+//             covers [2^L k, 2^L (k+1)), a 5 tap level is centred on 2^L k)
+//     -NEIGHBOR reads the nearest sample of the nearest level
+//     -otherwise sample both neighbouring levels bilinearly and blend
+//             them linearly (trilinear), an integral level reads one
+template< typename T >
+double Pyramid<T>::Sample(double x, double y, double level, InterpolateType type, int channel)
+{
+    int l0 = (int)floor(level);
+    double f = level - l0;
+    if( type == NEIGHBOR )
+    {
+        l0 = (int)round(level);
+        f = 0.0;
+    }
+
+    double value = 0.0;
+    for( int l=l0; l<=l0 + 1; l++ )
+    {
+        double w = (l == l0) ? 1.0 - f : f;
+        if( w == 0.0 )
+            continue;
+        const cv::Mat &m = Level(l);
+        double s = 1.0 / (1 << l);
+        double lx = this->reduce == REDUCE2X2 ? (x + 0.5)*s - 0.5 : x*s;
+        double ly = this->reduce == REDUCE2X2 ? (y + 0.5)*s - 0.5 : y*s;
+        if( type == NEIGHBOR )
+        {
+            int nx = std::min(std::max((int)round(lx), 0), m.cols - 1);
+            int ny = std::min(std::max((int)round(ly), 0), m.rows - 1);
+            value += w * m.ptr<typename cv::DataType<T>::channel_type>(ny)[nx * m.channels() + channel];
+        }
+        else
+            value += w * Bilinear(m, lx, ly, channel);
+    }
+    return value;
+}
+
+#endif
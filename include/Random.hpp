@@ -0,0 +1,49 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <opencv2/opencv.hpp>
+
+namespace Random
+{
+    typedef unsigned long long Word;
+
+    // -SplitMix64 finalizer, a bijective mix of all 64 bits
+    inline Word Mix(Word z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // -counter based generator: the value for (seed, index) depends on
+    //         nothing else, so any block can be made on any thread and
+    //         the stream is the same whatever the thread count
+    //     -the seed is mixed once so nearby seeds give unrelated streams
+    inline Word Next(Word seed, Word index)
+    {
+        return Mix(Mix(seed) + (index + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    // -uniform double in [0, 1) from the top 53 bits
+    inline double Uniform(Word seed, Word index)
+    {
+        return (Next(seed, index) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // -uniform integer in [0, n) by multiply-shift of the top 32 bits
+    inline unsigned int Below(Word value, unsigned int n)
+    {
+        return (unsigned int)(((value >> 32) * n) >> 32);
+    }
+
+    // -values for indices [first, first + count), the loop carries no
+    //         state from one element to the next
+    inline void Fill(Word seed, Word first, int count, Word *out)
+    {
+        const Word key = Mix(seed);
+        for( int k=0; k<count; k++ )
+            out[k] = Mix(key + (first + k + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+}
+
+#endif
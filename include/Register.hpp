@@ -0,0 +1,248 @@
+#ifndef REGISTER_H
+#define REGISTER_H
+
+#include "Spectrum.hpp"
+#include "FFT.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+
+
+namespace Register
+{
+    // Translation
+    // -offset (x, y) of a frame from the reference, the frame at (i, j)
+    //         is close to the reference at (i - y, j - x)
+    // -response: height of the correlation peak, 1 for an exact circular
+    //         shift and near 0 for unrelated images
+    struct Translation
+    {
+        double x, y;
+        double response;
+    };
+
+    // -Hann weights 0.5 (1 - cos(2 pi k / (n - 1))) for k < n, ones when
+    //         window is false
+    inline std::vector<double> Hann(int n, bool window)
+    {
+        std::vector<double> w(n, 1.0);
+        if( window && n > 1 )
+            for( int k=0; k<n; k++ )
+                w[k] = 0.5 * (1.0 - cos(2.0 * M_PI * k / (n - 1)));
+        return w;
+    }
+
+    // -channel 0 of real images a and b into the real and imaginary planes
+    //         of spectrum, top left, zero filled, b may be empty
+    //     -window tapers each image to zero at its own border so the wrap
+    //             around of the transform adds no edge to the correlation
+    template< typename T >
+    void Pack(const cv::Mat &a, const cv::Mat &b, Spectrum &spectrum, bool window)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        CV_Assert(a.rows <= spectrum.rows && a.cols <= spectrum.cols);
+        CV_Assert(b.rows <= spectrum.rows && b.cols <= spectrum.cols);
+        spectrum.re.setTo(cv::Scalar(0.0));
+        spectrum.im.setTo(cv::Scalar(0.0));
+
+        const cv::Mat *images[2] = {&a, &b};
+        cv::Mat *planes[2] = {&spectrum.re, &spectrum.im};
+        for( int n=0; n<2; n++ )
+        {
+            const cv::Mat &image = *images[n];
+            if( image.empty() )
+                continue;
+            const int cn = image.channels();
+            std::vector<double> wy = Hann(image.rows, window);
+            std::vector<double> wx = Hann(image.cols, window);
+            for( int i=0; i<image.rows; i++ )
+            {
+                const C *p = image.ptr<C>(i);
+                double *q = planes[n]->ptr<double>(i);
+                for( int j=0; j<image.cols; j++ )
+                    q[j] = wy[i] * wx[j] * p[j*cn];
+            }
+        }
+    }
+
+    // -x conj(y) / |x conj(y)|, zero where the product vanishes
+    inline void CrossPower(double xr, double xi, double yr, double yi, double &pr, double &pi)
+    {
+        double re = xr*yr + xi*yi;
+        double im = xi*yr - xr*yi;
+        double mag = sqrt(re*re + im*im);
+        if( mag > 1e-300 )
+        {
+            pr = re / mag;
+            pi = im / mag;
+        }
+        else
+            pr = pi = 0.0;
+    }
+
+    // -normalized cross-power spectra written over the transform z of two
+    //         packed real images, one row i and its mirror rows - i per index
+    //         of range, so every pair of conjugate samples is read and
+    //         replaced by the same thread
+    //     -the spectra of the two images are z(k) + conj z(-k) over 2 and
+    //             z(k) - conj z(-k) over 2i
+    //     -without reference z packs (a, b) and becomes B conj A over its
+    //             magnitude, with reference (spectrum of a) z packs two
+    //             frames (b1, b2) and becomes P1 + i P2, P_n = B_n conj A
+    //             over its magnitude, whose inverse is the two correlation
+    //             surfaces in its real and imaginary parts
+    class CrossPowerBody : public cv::ParallelLoopBody
+    {
+     public:
+        CrossPowerBody(Spectrum &z, const Spectrum *reference)
+            : z(z), reference(reference) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int rows = z.rows;
+            const int cols = z.cols;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                const int mi = (rows - i) % rows;
+                double *zr = z.re.ptr<double>(i), *zi = z.im.ptr<double>(i);
+                double *mr = z.re.ptr<double>(mi), *mz = z.im.ptr<double>(mi);
+                const double *ar = reference ? reference->re.ptr<double>(i) : NULL;
+                const double *ai = reference ? reference->im.ptr<double>(i) : NULL;
+                for( int j=0; j<cols; j++ )
+                {
+                    const int mj = (cols - j) % cols;
+                    if( mi == i && mj < j )
+                        continue;
+
+                    double wr = mr[mj], wi = -mz[mj];
+                    double sr = 0.5 * (zr[j] + wr), si = 0.5 * (zi[j] + wi);
+                    double tr = 0.5 * (zi[j] - wi), ti = 0.5 * (wr - zr[j]);
+
+                    double pr, pi, qr = 0.0, qi = 0.0;
+                    if( reference )
+                    {
+                        CrossPower(sr, si, ar[j], ai[j], pr, pi);
+                        CrossPower(tr, ti, ar[j], ai[j], qr, qi);
+                    }
+                    else
+                        CrossPower(tr, ti, sr, si, pr, pi);
+
+                    zr[j] = pr - qi;
+                    zi[j] = pi + qr;
+                    mr[mj] = pr + qi;
+                    mz[mj] = qr - pi;
+                }
+            }
+        }
+
+     private:
+        Spectrum &z;
+        const Spectrum *reference;
+    };
+
+    // -integer peak of a correlation surface refined to sub-pixel by a
+    //         parabola through it and its two neighbours on each axis,
+    //         neighbours wrap around, offsets past half the size are
+    //         negative
+    inline Translation Peak(const cv::Mat &surface)
+    {
+        cv::Point max;
+        double value;
+        cv::minMaxLoc(surface, NULL, &value, NULL, &max);
+
+        const int rows = surface.rows;
+        const int cols = surface.cols;
+        double l = surface.at<double>(max.y, (max.x + cols - 1) % cols);
+        double r = surface.at<double>(max.y, (max.x + 1) % cols);
+        double u = surface.at<double>((max.y + rows - 1) % rows, max.x);
+        double d = surface.at<double>((max.y + 1) % rows, max.x);
+        double dx = l - 2.0*value + r;
+        double dy = u - 2.0*value + d;
+
+        Translation t;
+        t.x = (max.x > cols / 2 ? max.x - cols : max.x) + (dx < 0.0 ? 0.5 * (l - r) / dx : 0.0);
+        t.y = (max.y > rows / 2 ? max.y - rows : max.y) + (dy < 0.0 ? 0.5 * (u - d) / dy : 0.0);
+        t.response = value / ((double)rows * cols);
+        return t;
+    }
+
+    // -translation of b from a by phase correlation
+    //     -both images go through one complex transform as the real and
+    //             imaginary parts, are separated by conjugate symmetry and
+    //             their normalized cross-power spectrum replaces the
+    //             transform in place before one inverse
+    //     -the transform is the power of 2 size holding both images, the
+    //             zero padding is skipped by the pruned transform
+    //     -window applies a Hann window to each image first
+    template< typename T >
+    Translation PhaseCorrelate(const cv::Mat &a, const cv::Mat &b, bool window = false)
+    {
+        cv::Size extent(std::max(a.cols, b.cols), std::max(a.rows, b.rows));
+        Spectrum z(FFT::Pow2(extent.height), FFT::Pow2(extent.width), false);
+        Pack<T>(a, b, z, window);
+        FFT::Transform(z, -1, extent);
+        cv::parallel_for_(cv::Range(0, z.rows/2 + 1), CrossPowerBody(z, NULL));
+        FFT::Transform(z, 1);
+        return Peak(z.re);
+    }
+
+
+    // Reference class
+    // -one image registered against many frames, its spectrum is computed
+    //         once when the Reference is made
+    // -frames are transformed two at a time, packed as real and imaginary
+    //         parts, so each pair costs one forward and one inverse
+    //         transform
+    // -frames must fit in the transform size of the reference
+    template< typename T >
+    class Reference {
+     public:
+        Reference(const cv::Mat &image, bool window = false);
+
+        Translation Correlate(const cv::Mat &frame) const;
+        std::vector<Translation> Correlate(const std::vector<cv::Mat> &frames) const;
+
+        Spectrum spectrum;
+        bool window;
+    };
+
+    template< typename T >
+    inline Reference<T>::Reference(const cv::Mat &image, bool window)
+        : spectrum(FFT::Pow2(image.rows), FFT::Pow2(image.cols), false), window(window)
+    {
+        Pack<T>(image, cv::Mat(), this->spectrum, window);
+        FFT::Transform(this->spectrum, -1, image.size());
+        this->spectrum.original = image.size();
+    }
+
+    template< typename T >
+    inline Translation Reference<T>::Correlate(const cv::Mat &frame) const
+    {
+        return Correlate(std::vector<cv::Mat>(1, frame))[0];
+    }
+
+    template< typename T >
+    inline std::vector<Translation> Reference<T>::Correlate(const std::vector<cv::Mat> &frames) const
+    {
+        std::vector<Translation> result;
+        Spectrum z(this->spectrum.rows, this->spectrum.cols, false);
+        for( size_t n=0; n<frames.size(); n+=2 )
+        {
+            const cv::Mat &first = frames[n];
+            const cv::Mat second = n + 1 < frames.size() ? frames[n + 1] : cv::Mat();
+            cv::Size extent(std::max(first.cols, second.cols), std::max(first.rows, second.rows));
+            Pack<T>(first, second, z, this->window);
+            FFT::Transform(z, -1, extent);
+            cv::parallel_for_(cv::Range(0, z.rows/2 + 1), CrossPowerBody(z, &this->spectrum));
+            FFT::Transform(z, 1);
+
+            result.push_back(Peak(z.re));
+            if( !second.empty() )
+                result.push_back(Peak(z.im));
+        }
+        return result;
+    }
+}
+
+#endif
@@ -0,0 +1,399 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "Interpolate.hpp"
+#include "Pool.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace Resample
+{
+    // Table
+    // -precomputed 1D weights for every output position along one axis
+    //         taps entries per position, source indices already clamped
+    //         to the line so the inner loops never test bounds
+    // -positions with fewer taps are padded with zero weights on their own
+    //         last index, so every index is one the position really reads
+    // -index (CV_32S) and weight (F) hold one row of taps per position
+    // -F is the working precision, double for CV_64F sources
+    template< typename F >
+    struct Table
+    {
+        int taps;
+        cv::Mat index;
+        cv::Mat weight;
+    };
+
+    inline double Triangle(double t)
+    {
+        t = fabs(t);
+        return t < 1.0 ? 1.0 - t : 0.0;
+    }
+
+    // -Keys cubic convolution kernel with a = -0.5
+    inline double Cubic(double t)
+    {
+        t = fabs(t);
+        if( t < 1.0 )
+            return (1.5*t - 2.5)*t*t + 1.0;
+        if( t < 2.0 )
+            return ((-0.5*t + 2.5)*t - 4.0)*t + 2.0;
+        return 0.0;
+    }
+
+    inline double Lanczos3(double t)
+    {
+        t = fabs(t);
+        if( t < 1e-8 )
+            return 1.0;
+        if( t >= 3.0 )
+            return 0.0;
+        double x = M_PI * t;
+        return 3.0 * sin(x) * sin(x / 3.0) / (x * x);
+    }
+
+    inline double Support(InterpolateType type)
+    {
+        switch(type)
+        {
+            case(BILINEAR):
+                return 1.0;
+            case(BICUBIC):
+                return 2.0;
+            case(LANCZOS3):
+                return 3.0;
+            default:
+                return 0.5;
+        }
+    }
+
+    inline double Kernel(InterpolateType type, double t)
+    {
+        switch(type)
+        {
+            case(BICUBIC):
+                return Cubic(t);
+            case(LANCZOS3):
+                return Lanczos3(t);
+            default:
+                return Triangle(t);
+        }
+    }
+
+    // -build the weights for size output positions sampling a source
+    //         line of length n at x = scale*k + offset
+    //     -NEIGHBOR takes the rounded position
+    //     -AVERAGE takes the mean of floor(x) and ceil(x) when enlarging
+    //             and the area covered by [x, x + scale) when reducing
+    //     -BILINEAR, BICUBIC and LANCZOS3 stretch their kernel by scale
+    //             when reducing so every source sample contributes
+    //     -weights are normalized to sum to 1
+    //     -the table and its scratch come from pool when given, give the
+    //             table back with ReleaseTable
+    template< typename F >
+    void CreateTable(Table<F> &table, int size, int n, double scale, double offset, InterpolateType type, Pool *pool = NULL)
+    {
+        double stretch = std::max(1.0, fabs(scale));
+
+        // taps of position k at k * bound, at most bound of them
+        int bound = type == NEIGHBOR ? 1 : type == AVERAGE ? (int)ceil(stretch) + 2 : (int)ceil(2.0 * Support(type) * stretch) + 3;
+        cv::Mat idxData = Buffer::Acquire(pool, size, bound, CV_32S);
+        cv::Mat wgtData = Buffer::Acquire(pool, size, bound, CV_64F);
+        cv::Mat countData = Buffer::Acquire(pool, 1, size, CV_32S);
+        int *count = countData.ptr<int>(0);
+
+        for( int k=0; k<size; k++ )
+        {
+            int *idx = idxData.ptr<int>(k);
+            double *wgt = wgtData.ptr<double>(k);
+            int c = 0;
+            double x = scale*k + offset;
+            if( type == NEIGHBOR )
+            {
+                idx[c] = (int)round(x);
+                wgt[c++] = 1.0;
+            }
+            else if( type == AVERAGE && stretch == 1.0 )
+            {
+                idx[c] = (int)floor(x);
+                wgt[c++] = 0.5;
+                idx[c] = (int)ceil(x);
+                wgt[c++] = 0.5;
+            }
+            else if( type == AVERAGE )
+            {
+                double lo = std::min(x, x + scale);
+                double hi = std::max(x, x + scale);
+                for( int p=(int)floor(lo); p<(int)ceil(hi); p++ )
+                {
+                    idx[c] = p;
+                    wgt[c++] = std::min(hi, p + 1.0) - std::max(lo, (double)p);
+                }
+            }
+            else
+            {
+                double support = Support(type) * stretch;
+                for( int p=(int)floor(x - support); p<=(int)ceil(x + support); p++ )
+                {
+                    double w = Kernel(type, (p - x) / stretch);
+                    if( w != 0.0 )
+                    {
+                        idx[c] = p;
+                        wgt[c++] = w;
+                    }
+                }
+                if( c == 0 )
+                {
+                    idx[c] = (int)round(x);
+                    wgt[c++] = 1.0;
+                }
+            }
+            CV_Assert(c <= bound);
+            count[k] = c;
+        }
+
+        table.taps = 1;
+        for( int k=0; k<size; k++ )
+            table.taps = std::max(table.taps, count[k]);
+
+        table.index = Buffer::Acquire(pool, size, table.taps, CV_32S);
+        table.weight = Buffer::Acquire(pool, size, table.taps, cv::DataType<F>::type);
+        for( int k=0; k<size; k++ )
+        {
+            const int *idx = idxData.ptr<int>(k);
+            const double *wgt = wgtData.ptr<double>(k);
+            double sum = 0.0;
+            for( int t=0; t<count[k]; t++ )
+                sum += wgt[t];
+            int *index = table.index.template ptr<int>(k);
+            F *weight = table.weight.template ptr<F>(k);
+            for( int t=0; t<count[k]; t++ )
+            {
+                index[t] = std::min(std::max(idx[t], 0), n - 1);
+                weight[t] = (F)(wgt[t] / sum);
+            }
+            for( int t=count[k]; t<table.taps; t++ )
+            {
+                index[t] = index[t - 1];
+                weight[t] = (F)0;
+            }
+        }
+
+        Buffer::Release(pool, countData);
+        Buffer::Release(pool, wgtData);
+        Buffer::Release(pool, idxData);
+    }
+
+    template< typename F >
+    void ReleaseTable(Table<F> &table, Pool *pool = NULL)
+    {
+        Buffer::Release(pool, table.weight);
+        Buffer::Release(pool, table.index);
+    }
+
+    // -horizontal pass: resample source rows [first, first + tmp.rows)
+    //         into the F buffer tmp using the column table
+    template< typename T, typename F >
+    class HorizontalBody : public cv::ParallelLoopBody
+    {
+     public:
+        HorizontalBody(const cv::Mat &source, cv::Mat &tmp, const Table<F> &table, int first)
+            : source(source), tmp(tmp), table(table), first(first) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            const int cn = source.channels();
+            const int cols = tmp.cols / cn;
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                const C *s = source.ptr<C>(first + i);
+                F *d = tmp.ptr<F>(i);
+                for( int j=0; j<cols; j++ )
+                {
+                    const int *index = table.index.template ptr<int>(j);
+                    const F *weight = table.weight.template ptr<F>(j);
+                    for( int k=0; k<cn; k++ )
+                    {
+                        F sum = 0;
+                        for( int t=0; t<table.taps; t++ )
+                            sum += weight[t] * s[index[t]*cn + k];
+                        d[j*cn + k] = sum;
+                    }
+                }
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        cv::Mat &tmp;
+        const Table<F> &table;
+        int first;
+    };
+
+    // -vertical pass: each output row is a weighted sum of whole rows
+    //         of tmp, accumulated contiguously then saturated into dest
+    //     -the accumulator row comes from pool when given
+    template< typename T, typename F >
+    class VerticalBody : public cv::ParallelLoopBody
+    {
+     public:
+        VerticalBody(const cv::Mat &tmp, cv::Mat &dest, const Table<F> &table, int first, Pool *pool)
+            : tmp(tmp), dest(dest), table(table), first(first), pool(pool) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            const int width = tmp.cols;
+            cv::Mat buffer = Buffer::Acquire(pool, 1, width, tmp.type());
+            F *acc = buffer.ptr<F>(0);
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                std::fill(acc, acc + width, (F)0);
+                const int *index = table.index.template ptr<int>(i);
+                const F *weight = table.weight.template ptr<F>(i);
+                for( int t=0; t<table.taps; t++ )
+                {
+                    F w = weight[t];
+                    if( w == 0 )
+                        continue;
+                    const F *s = tmp.ptr<F>(index[t] - first);
+                    for( int j=0; j<width; j++ )
+                        acc[j] += w * s[j];
+                }
+
+                C *d = dest.ptr<C>(i);
+                for( int j=0; j<width; j++ )
+                    d[j] = cv::saturate_cast<C>(acc[j]);
+            }
+            Buffer::Release(pool, buffer);
+        }
+
+     private:
+        const cv::Mat &tmp;
+        cv::Mat &dest;
+        const Table<F> &table;
+        int first;
+        Pool *pool;
+    };
+
+    // -integer decimation: average each kx by ky block with integer
+    //         accumulators, rows summed first so the columns are read once
+    //     -the accumulator row comes from pool when given
+    template< typename T >
+    class BoxBody : public cv::ParallelLoopBody
+    {
+     public:
+        BoxBody(const cv::Mat &source, cv::Mat &dest, int kx, int tx, int ky, int ty, Pool *pool)
+            : source(source), dest(dest), kx(kx), tx(tx), ky(ky), ty(ty), pool(pool) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            typedef typename cv::DataType<T>::channel_type C;
+            typedef typename cv::DataType<C>::work_type W;
+            const int cn = source.channels();
+            const int width = source.cols * cn;
+            const double scale = 1.0 / (kx * ky);
+            cv::Mat buffer = Buffer::Acquire(pool, 1, width, cv::DataType<W>::type);
+            W *acc = buffer.ptr<W>(0);
+
+            for( int i=range.start; i<range.end; i++ )
+            {
+                std::fill(acc, acc + width, (W)0);
+                for( int r=0; r<ky; r++ )
+                {
+                    int y = std::min(std::max(ky*i + ty + r, 0), source.rows - 1);
+                    const C *s = source.ptr<C>(y);
+                    for( int j=0; j<width; j++ )
+                        acc[j] += s[j];
+                }
+
+                C *d = dest.ptr<C>(i);
+                for( int j=0; j<dest.cols; j++ )
+                    for( int k=0; k<cn; k++ )
+                    {
+                        W sum = 0;
+                        for( int q=0; q<kx; q++ )
+                        {
+                            int x = std::min(std::max(kx*j + tx + q, 0), source.cols - 1);
+                            sum += acc[x*cn + k];
+                        }
+                        d[j*cn + k] = cv::saturate_cast<C>(sum * scale);
+                    }
+            }
+            Buffer::Release(pool, buffer);
+        }
+
+     private:
+        const cv::Mat &source;
+        cv::Mat &dest;
+        int kx, tx, ky, ty;
+        Pool *pool;
+    };
+
+    inline bool isInteger(double v)
+    {
+        return fabs(v - round(v)) < 1e-9;
+    }
+
+    // -build a column and a row table once and run two separable passes
+    //         through an F buffer holding only the source rows the row
+    //         table touches, tables and buffers from pool when given
+    template< typename T, typename F >
+    void Separable(const cv::Mat &source, cv::Mat &dest, double sx, double tx, double sy, double ty, InterpolateType type, Pool *pool)
+    {
+        Table<F> columns, rows;
+        CreateTable(columns, dest.cols, source.cols, sx, tx, type, pool);
+        CreateTable(rows, dest.rows, source.rows, sy, ty, type, pool);
+
+        int first = source.rows;
+        int last = 0;
+        for( int k=0; k<rows.index.rows; k++ )
+        {
+            const int *index = rows.index.template ptr<int>(k);
+            for( int t=0; t<rows.taps; t++ )
+            {
+                first = std::min(first, index[t]);
+                last = std::max(last, index[t]);
+            }
+        }
+
+        cv::Mat tmp = Buffer::Acquire(pool, last - first + 1, dest.cols * source.channels(), cv::DataType<F>::type);
+        cv::parallel_for_(cv::Range(0, tmp.rows), HorizontalBody<T, F>(source, tmp, columns, first));
+        cv::parallel_for_(cv::Range(0, dest.rows), VerticalBody<T, F>(tmp, dest, rows, first, pool), cv::getNumThreads());
+        Buffer::Release(pool, tmp);
+        ReleaseTable(rows, pool);
+        ReleaseTable(columns, pool);
+    }
+
+    // -resample source into dest (already sized) sampling the source at
+    //         x = sx*j + tx, y = sy*i + ty for destination location (j, i)
+    // -AVERAGE with integer decimation factors takes the box fast path
+    // -passes with a row accumulator run one stripe per thread so each
+    //         thread takes it once
+    // -otherwise the separable passes, in float unless the source is
+    //         CV_64F
+    template< typename T >
+    void Resize(const cv::Mat &source, cv::Mat &dest, double sx, double tx, double sy, double ty, InterpolateType type, Pool *pool = NULL)
+    {
+        if( type == AVERAGE && isInteger(sx) && isInteger(sy) && isInteger(tx) && isInteger(ty)
+                && sx >= 1.0 && sy >= 1.0 && sx*sy > 1.0 )
+        {
+            cv::parallel_for_(cv::Range(0, dest.rows),
+                    BoxBody<T>(source, dest, (int)round(sx), (int)round(tx), (int)round(sy), (int)round(ty), pool), cv::getNumThreads());
+            return;
+        }
+
+        if( source.depth() == CV_64F )
+            Separable<T, double>(source, dest, sx, tx, sy, ty, type, pool);
+        else
+            Separable<T, float>(source, dest, sx, tx, sy, ty, type, pool);
+    }
+}
+
+#endif
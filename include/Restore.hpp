@@ -0,0 +1,223 @@
+#ifndef RESTORE_H
+#define RESTORE_H
+
+#include "Spectrum.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <map>
+#include <deque>
+
+enum DegradationType {BLUR_MOTION = 0, BLUR_TURBULENCE = 1, BLUR_GAUSSIAN = 2};
+enum RestoreType {RESTORE_INVERSE = 0, RESTORE_PSEUDO = 1, RESTORE_WIENER = 2};
+
+namespace Restore
+{
+    // Key
+    // -everything a transfer function depends on
+    struct Key
+    {
+        DegradationType type;
+        double a, b, t;
+        int rows, cols;
+        bool centred;
+
+        bool operator<(const Key &k) const
+        {
+            if( type != k.type ) return type < k.type;
+            if( a != k.a ) return a < k.a;
+            if( b != k.b ) return b < k.b;
+            if( t != k.t ) return t < k.t;
+            if( rows != k.rows ) return rows < k.rows;
+            if( cols != k.cols ) return cols < k.cols;
+            return centred < k.centred;
+        }
+    };
+
+    // -transfer function H(u, v) as a 2 channel CV_64F Mat
+    //     -BLUR_MOTION: uniform linear motion of a, b over exposure t,
+    //             H = t sin(pi w)/(pi w) e^(-i pi w) with w = u*a + v*b
+    //     -BLUR_TURBULENCE: H = e^(-a (u^2 + v^2)^(5/6))
+    //     -BLUR_GAUSSIAN: H = e^(-(u^2 + v^2) / (2 a^2))
+    inline cv::Mat Create(const Key &key)
+    {
+        cv::Mat H(key.rows, key.cols, CV_64FC2);
+        for( int i=0; i<key.rows; i++ )
+        {
+            double u = Frequency(i, key.rows, key.centred);
+            double *p = H.ptr<double>(i);
+            for( int j=0; j<key.cols; j++ )
+            {
+                double v = Frequency(j, key.cols, key.centred);
+                double d2 = u*u + v*v;
+                double re = 0.0, im = 0.0;
+                switch(key.type)
+                {
+                    case(BLUR_MOTION):
+                    {
+                        double w = M_PI * (u*key.a + v*key.b);
+                        double mag = w == 0.0 ? key.t : key.t * sin(w) / w;
+                        re = mag * cos(w);
+                        im = -mag * sin(w);
+                        break;
+                    }
+                    case(BLUR_TURBULENCE):
+                        re = exp(-key.a * pow(d2, 5.0/6.0));
+                        break;
+                    case(BLUR_GAUSSIAN):
+                        re = exp(-d2 / (2.0 * key.a * key.a));
+                        break;
+                }
+                p[2*j] = re;
+                p[2*j + 1] = im;
+            }
+        }
+        return H;
+    }
+
+    inline cv::Mutex& CacheLock()
+    {
+        static cv::Mutex lock;
+        return lock;
+    }
+
+    inline std::map<Key, cv::Mat>& Cache()
+    {
+        static std::map<Key, cv::Mat> cache;
+        return cache;
+    }
+
+    // -keys of Cache oldest first, the oldest transfer function is dropped
+    //         once CacheCapacity are held
+    inline std::deque<Key>& CacheOrder()
+    {
+        static std::deque<Key> order;
+        return order;
+    }
+
+    const size_t CacheCapacity = 32;
+
+    // -cached transfer function for a rows x cols spectrum
+    //     -built once per parameter set and size, each call returns its
+    //             own copy so the caller may write to it
+    //     -at most CacheCapacity are kept, the oldest is dropped first,
+    //             ClearCache drops them all
+    //     -b and t are only used by BLUR_MOTION
+    inline cv::Mat Transfer(DegradationType type, double a, double b, double t, int rows, int cols, bool centred = true)
+    {
+        Key key;
+        key.type = type;
+        key.a = a;
+        key.b = type == BLUR_MOTION ? b : 0.0;
+        key.t = type == BLUR_MOTION ? t : 0.0;
+        key.rows = rows;
+        key.cols = cols;
+        key.centred = centred;
+
+        cv::AutoLock lock(CacheLock());
+        std::map<Key, cv::Mat>::iterator it = Cache().find(key);
+        if( it != Cache().end() )
+            return it->second.clone();
+        cv::Mat H = Create(key);
+        if( CacheOrder().size() >= CacheCapacity )
+        {
+            Cache().erase(CacheOrder().front());
+            CacheOrder().pop_front();
+        }
+        Cache()[key] = H;
+        CacheOrder().push_back(key);
+        return H.clone();
+    }
+
+    inline void ClearCache()
+    {
+        cv::AutoLock lock(CacheLock());
+        Cache().clear();
+        CacheOrder().clear();
+    }
+
+    // -F = G * H or the restoration of G by H in place, one row per index
+    //     -RESTORE_INVERSE: F = G / H, 0 where H = 0
+    //     -RESTORE_PSEUDO: F = G / H where |H| > k, 0 elsewhere
+    //     -RESTORE_WIENER: F = G conj(H) / (|H|^2 + k)
+    class FilterBody : public cv::ParallelLoopBody
+    {
+     public:
+        FilterBody(const ComplexRows<double> &spectrum, const cv::Mat &H, bool degrade, RestoreType type, double k)
+            : spectrum(spectrum), H(H), degrade(degrade), type(type), k(k) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            for( int i=range.start; i<range.end; i++ )
+            {
+                double *re = spectrum.Re(i);
+                double *im = spectrum.Im(i);
+                const int stride = spectrum.stride;
+                const double *h = H.ptr<double>(i);
+                for( int j=0; j<spectrum.cols; j++ )
+                {
+                    double &gr = re[j*stride], &gi = im[j*stride];
+                    double hr = h[2*j], hi = h[2*j + 1];
+                    if( degrade )
+                    {
+                        double r = gr*hr - gi*hi;
+                        gi = gr*hi + gi*hr;
+                        gr = r;
+                        continue;
+                    }
+
+                    double power = hr*hr + hi*hi;
+                    double scale;
+                    if( type == RESTORE_WIENER )
+                        scale = 1.0 / (power + k);
+                    else if( power == 0.0 || (type == RESTORE_PSEUDO && power <= k*k) )
+                        scale = 0.0;
+                    else
+                        scale = 1.0 / power;
+
+                    // G conj(H) * scale
+                    double r = (gr*hr + gi*hi) * scale;
+                    gi = (gi*hr - gr*hi) * scale;
+                    gr = r;
+                }
+            }
+        }
+
+     private:
+        const ComplexRows<double> &spectrum;
+        const cv::Mat &H;
+        bool degrade;
+        RestoreType type;
+        double k;
+    };
+
+    // -G = F * H in place
+    inline void Degrade(cv::Mat &spectrum, const cv::Mat &H)
+    {
+        CV_Assert(spectrum.type() == CV_64FC2 && H.type() == CV_64FC2 && spectrum.size() == H.size());
+        cv::parallel_for_(cv::Range(0, spectrum.rows), FilterBody(ComplexRows<double>(spectrum), H, true, RESTORE_INVERSE, 0.0));
+    }
+
+    inline void Degrade(Spectrum &spectrum, const cv::Mat &H)
+    {
+        CV_Assert(H.type() == CV_64FC2 && spectrum.rows == H.rows && spectrum.cols == H.cols);
+        cv::parallel_for_(cv::Range(0, spectrum.rows), FilterBody(ComplexRows<double>(spectrum), H, true, RESTORE_INVERSE, 0.0));
+    }
+
+    // -estimate F from G = F * H in place with a single pass over the
+    //         spectrum, k is the pseudo-inverse threshold on |H| or the
+    //         Wiener noise to signal ratio
+    inline void Apply(cv::Mat &spectrum, const cv::Mat &H, RestoreType type, double k = 0.0)
+    {
+        CV_Assert(spectrum.type() == CV_64FC2 && H.type() == CV_64FC2 && spectrum.size() == H.size());
+        cv::parallel_for_(cv::Range(0, spectrum.rows), FilterBody(ComplexRows<double>(spectrum), H, false, type, k));
+    }
+
+    inline void Apply(Spectrum &spectrum, const cv::Mat &H, RestoreType type, double k = 0.0)
+    {
+        CV_Assert(H.type() == CV_64FC2 && spectrum.rows == H.rows && spectrum.cols == H.cols);
+        cv::parallel_for_(cv::Range(0, spectrum.rows), FilterBody(ComplexRows<double>(spectrum), H, false, type, k));
+    }
+}
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef SHEAR_H
+#define SHEAR_H
+
+#include "Interpolate.hpp"
+#include "Resample.hpp"
+#include "Pool.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace Shear
+{
+    // -rotations are only worth three passes on images at least this big
+    const int MinPixels = 512*512;
+
+    // Plane
+    // -buffer holding the logical rectangle whose top-left is (x, y),
+    //         samples outside the rectangle read as 0
+    struct Plane
+    {
+        cv::Mat data;
+        int x, y;
+    };
+
+    // Taps
+    // -sample at s = sum weight[t] * line[base + t]
+    struct Taps
+    {
+        int base;
+        int count;
+        float weight[6];
+    };
+
+    inline int Radius(InterpolateType type)
+    {
+        return type == NEIGHBOR ? 0 : (int)ceil(Resample::Support(type == AVERAGE ? BILINEAR : type));
+    }
+
+    inline Taps Weights(double s, InterpolateType type)
+    {
+        Taps taps;
+        if( type == NEIGHBOR )
+        {
+            taps.base = (int)round(s);
+            taps.count = 1;
+            taps.weight[0] = 1.0f;
+            return taps;
+        }
+
+        int radius = Radius(type);
+        InterpolateType kernel = type == AVERAGE ? BILINEAR : type;
+        taps.base = (int)floor(s) - radius + 1;
+        taps.count = 2*radius;
+        double w[6];
+        double sum = 0.0;
+        for( int t=0; t<taps.count; t++ )
+        {
+            w[t] = Resample::Kernel(kernel, s - (taps.base + t));
+            sum += w[t];
+        }
+        for( int t=0; t<taps.count; t++ )
+            taps.weight[t] = (float)(w[t] / sum);
+        return taps;
+    }
+
+    // -dest(x, y) = source(x + a*y + e, y) along every row of dest
+    //     -the shift is constant along a row so its weights are built once
+    //     -columns whose taps all land inside the source skip bounds tests
+    template< typename S, typename D >
+    class RowBody : public cv::ParallelLoopBody
+    {
+     public:
+        RowBody(const Plane &source, Plane &dest, double a, double e, InterpolateType type)
+            : source(source), dest(dest), a(a), e(e), type(type) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int cn = dest.data.channels();
+            const int width = dest.data.cols;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                D *d = dest.data.ptr<D>(i);
+                int y = dest.y + i - source.y;
+                if( y < 0 || y >= source.data.rows )
+                {
+                    std::fill(d, d + width*cn, (D)0);
+                    continue;
+                }
+
+                const S *s = source.data.ptr<S>(y);
+                Taps taps = Weights(a*(dest.y + i) + e, type);
+                int offset = dest.x + taps.base - source.x;
+                int lo = std::min(std::max(0, -offset), width);
+                int hi = std::max(std::min(width, source.data.cols - offset - taps.count + 1), lo);
+
+                for( int j=0; j<width; j++ )
+                {
+                    if( j == lo )
+                    {
+                        // interior: every tap lands inside the source row
+                        for( ; j<hi; j++ )
+                            for( int k=0; k<cn; k++ )
+                            {
+                                const S *p = s + (j + offset)*cn + k;
+                                float sum = 0.0f;
+                                for( int t=0; t<taps.count; t++ )
+                                    sum += taps.weight[t] * p[t*cn];
+                                d[j*cn + k] = cv::saturate_cast<D>(sum);
+                            }
+                        if( j == width )
+                            break;
+                    }
+                    for( int k=0; k<cn; k++ )
+                    {
+                        float sum = 0.0f;
+                        for( int t=0; t<taps.count; t++ )
+                        {
+                            int x = j + offset + t;
+                            if( x >= 0 && x < source.data.cols )
+                                sum += taps.weight[t] * s[x*cn + k];
+                        }
+                        d[j*cn + k] = cv::saturate_cast<D>(sum);
+                    }
+                }
+            }
+        }
+
+     private:
+        const Plane &source;
+        Plane &dest;
+        double a, e;
+        InterpolateType type;
+    };
+
+    // -dest(x, y) = source(x, y + b*x + e) down every column of dest
+    //     -the shift is constant down a column so weights are built once
+    //             per column while rows are still written contiguously
+    template< typename S, typename D >
+    class ColBody : public cv::ParallelLoopBody
+    {
+     public:
+        ColBody(const Plane &source, Plane &dest, const Taps *taps)
+            : source(source), dest(dest), taps(taps) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int cn = dest.data.channels();
+            const int width = dest.data.cols;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                D *d = dest.data.ptr<D>(i);
+                int y = dest.y + i - source.y;
+                for( int j=0; j<width; j++ )
+                {
+                    const Taps &tap = taps[j];
+                    int x = (dest.x + j - source.x)*cn;
+                    int row = y + tap.base;
+                    bool inside = x >= 0 && x < source.data.cols*cn && row >= 0 && row + tap.count <= source.data.rows;
+                    for( int k=0; k<cn; k++ )
+                    {
+                        float sum = 0.0f;
+                        for( int t=0; t<tap.count; t++ )
+                            if( inside || (row + t >= 0 && row + t < source.data.rows && x >= 0 && x < source.data.cols*cn) )
+                                sum += tap.weight[t] * source.data.ptr<S>(row + t)[x + k];
+                        d[j*cn + k] = cv::saturate_cast<D>(sum);
+                    }
+                }
+            }
+        }
+
+     private:
+        const Plane &source;
+        Plane &dest;
+        const Taps *taps;
+    };
+
+    template< typename S, typename D >
+    void Rows(const Plane &source, Plane &dest, double a, double e, InterpolateType type)
+    {
+        cv::parallel_for_(cv::Range(0, dest.data.rows), RowBody<S, D>(source, dest, a, e, type));
+    }
+
+    // -the per column taps are held in a buffer from pool when given
+    template< typename S, typename D >
+    void Cols(const Plane &source, Plane &dest, double b, double e, InterpolateType type, Pool *pool = NULL)
+    {
+        cv::Mat buffer = Buffer::Acquire(pool, 1, (int)(dest.data.cols * sizeof(Taps)), CV_8U);
+        Taps *taps = (Taps*)buffer.data;
+        for( int j=0; j<dest.data.cols; j++ )
+            taps[j] = Weights(b*(dest.x + j) + e, type);
+        cv::parallel_for_(cv::Range(0, dest.data.rows), ColBody<S, D>(source, dest, taps));
+        Buffer::Release(pool, buffer);
+    }
+
+    // -range of a*u + v + e over the corners of [u0, u1] x [v0, v1],
+    //         widened by the kernel radius
+    inline void Extent(double a, double e, int u0, int u1, int v0, int v1, int radius, int &lo, int &hi)
+    {
+        double m0 = std::min(a*u0, a*u1) + v0 + e;
+        double m1 = std::max(a*u0, a*u1) + v1 + e;
+        lo = (int)floor(m0) - radius - 1;
+        hi = (int)ceil(m1) + radius + 1;
+    }
+
+    // -Paeth rotation of source into dest, sampling source at Ti * D
+    //         where the linear part of Ti is a rotation R(phi)
+    //     -take out whole quarter turns exactly, rotating the source by
+    //             k*90 degrees so the residual |phi| <= 45 degrees
+    //     -R(phi) = X(a) Y(b) X(a) with a = -tan(phi/2), b = sin(phi),
+    //             X(a) shifting rows by a*y and Y(b) shifting columns by b*x
+    //     -D(p) = S(X(a) (Y(b) (X(a) p) + (0, e2)) + (e1, 0)) is split into
+    //             three 1D passes, each intermediate sized to what the
+    //             next pass reads:
+    //             I1(q) = S(qx + a*qy + e1, qy)
+    //             I2(r) = I1(rx, ry + b*rx + e2)
+    //             D(p)  = I2(px + a*py, py)
+    //     -the rotated base and both intermediates come from pool when given
+    template< typename T >
+    void Rotate(const cv::Mat &source, cv::Mat &dest, const double *ti, InterpolateType type, Pool *pool = NULL)
+    {
+        typedef typename cv::DataType<T>::channel_type C;
+        const int cn = source.channels();
+
+        double phi = atan2(ti[3], ti[0]);
+        int k = (int)round(phi / (M_PI / 2.0));
+        phi -= k * (M_PI / 2.0);
+        k = ((k % 4) + 4) % 4;
+        static const int cs[4] = {1, 0, -1, 0};
+        static const int sn[4] = {0, 1, 0, -1};
+
+        // S'(q) = S(R(k) q) covers R(-k) applied to the source rectangle
+        Plane base;
+        if( k == 0 )
+        {
+            base.data = source;
+            base.x = 0;
+            base.y = 0;
+        }
+        else
+        {
+            int xs[2] = {0, source.cols - 1};
+            int ys[2] = {0, source.rows - 1};
+            int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+            for( int m=0; m<4; m++ )
+            {
+                int x = cs[k]*xs[m & 1] + sn[k]*ys[m >> 1];
+                int y = -sn[k]*xs[m & 1] + cs[k]*ys[m >> 1];
+                x0 = std::min(x0, x);
+                x1 = std::max(x1, x);
+                y0 = std::min(y0, y);
+                y1 = std::max(y1, y);
+            }
+            base.x = x0;
+            base.y = y0;
+            base.data = Buffer::Acquire(pool, y1 - y0 + 1, x1 - x0 + 1, source.type());
+            const size_t size = source.elemSize();
+            for( int i=0; i<base.data.rows; i++ )
+            {
+                uchar *d = base.data.ptr(i);
+                for( int j=0; j<base.data.cols; j++ )
+                {
+                    int qx = x0 + j;
+                    int qy = y0 + i;
+                    int x = cs[k]*qx - sn[k]*qy;
+                    int y = sn[k]*qx + cs[k]*qy;
+                    memcpy(d + j*size, source.ptr(y) + x*size, size);
+                }
+            }
+        }
+
+        double tx = cs[k]*ti[2] + sn[k]*ti[5];
+        double ty = -sn[k]*ti[2] + cs[k]*ti[5];
+        double a = -tan(phi / 2.0);
+        double b = sin(phi);
+        double e1 = tx - a*ty;
+        double e2 = ty;
+        int radius = Radius(type);
+
+        int W = dest.cols;
+        int H = dest.rows;
+
+        Plane i2;
+        int lo, hi;
+        Extent(a, 0.0, 0, H - 1, 0, W - 1, radius, lo, hi);
+        i2.x = lo;
+        i2.y = 0;
+        i2.data = Buffer::Acquire(pool, H, hi - lo + 1, CV_32FC(cn));
+
+        Plane i1;
+        int ylo, yhi;
+        Extent(b, e2, i2.x, i2.x + i2.data.cols - 1, 0, H - 1, radius, ylo, yhi);
+        i1.x = i2.x;
+        i1.y = ylo;
+        i1.data = Buffer::Acquire(pool, yhi - ylo + 1, i2.data.cols, CV_32FC(cn));
+
+        Plane out;
+        out.data = dest;
+        out.x = 0;
+        out.y = 0;
+
+        Rows<C, float>(base, i1, a, e1, type);
+        Cols<float, float>(i1, i2, b, e2, type, pool);
+        Rows<float, C>(i2, out, a, 0.0, type);
+
+        Buffer::Release(pool, i2.data);
+        Buffer::Release(pool, i1.data);
+        if( k != 0 )
+            Buffer::Release(pool, base.data);
+    }
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "Pool.hpp"
+
+#include <opencv2/opencv.hpp>
+
+
+// Spectrum class
+// -complex data held as two CV_64F planes, re and im, rather than one
+//         interleaved CV_64FC2 Mat, so each part is read and written in
+//         place without split or merge
+// -every row of both planes starts on a 64 byte boundary
+// -shifted: the zero frequency has been moved to the centre
+// -original: size of the image before it was padded to the transform size
+// -copies share data like Mat, clone makes a deep copy
+// -with a pool the planes come from it, give them back with release(pool)
+class Spectrum {
+ public:
+    Spectrum();
+    Spectrum(int rows, int cols, bool shifted = true, Pool *pool = NULL);
+    explicit Spectrum(const cv::Mat &complex, bool shifted = true);
+
+    void create(int rows, int cols, Pool *pool = NULL);
+    void release(Pool *pool = NULL);
+    Spectrum clone(Pool *pool = NULL) const;
+    cv::Mat Interleave() const;
+    bool empty() const;
+
+    cv::Mat re;
+    cv::Mat im;
+    int rows;
+    int cols;
+    cv::Size original;
+    bool shifted;
+
+ private:
+    cv::Mat storage;
+};
+
+inline Spectrum::Spectrum()
+    : rows(0), cols(0), shifted(false)
+{
+}
+
+inline Spectrum::Spectrum(int rows, int cols, bool shifted, Pool *pool)
+    : rows(0), cols(0), original(cols, rows), shifted(shifted)
+{
+    create(rows, cols, pool);
+}
+
+// -copy of a 2 channel float or double Mat
+inline Spectrum::Spectrum(const cv::Mat &complex, bool shifted)
+    : rows(0), cols(0), original(complex.cols, complex.rows), shifted(shifted)
+{
+    CV_Assert(complex.channels() == 2 && (complex.depth() == CV_64F || complex.depth() == CV_32F));
+    create(complex.rows, complex.cols);
+    for( int i=0; i<this->rows; i++ )
+    {
+        double *a = this->re.ptr<double>(i);
+        double *b = this->im.ptr<double>(i);
+        if( complex.depth() == CV_64F )
+        {
+            const double *p = complex.ptr<double>(i);
+            for( int j=0; j<this->cols; j++ )
+            {
+                a[j] = p[2*j];
+                b[j] = p[2*j + 1];
+            }
+        }
+        else
+        {
+            const float *p = complex.ptr<float>(i);
+            for( int j=0; j<this->cols; j++ )
+            {
+                a[j] = p[2*j];
+                b[j] = p[2*j + 1];
+            }
+        }
+    }
+}
+
+// -both planes in one allocation, re rows first, each row padded to a
+//         multiple of 64 bytes, contents are left uninitialised
+// -storage of another size is given back first, to pool when given
+inline void Spectrum::create(int rows, int cols, Pool *pool)
+{
+    if( rows == this->rows && cols == this->cols && !this->re.empty() )
+        return;
+
+    size_t step = cv::alignSize(cols * sizeof(double), 64);
+    Buffer::Release(pool, this->storage);
+    this->storage = Buffer::Acquire(pool, 1, (int)(2 * rows * step + 64), CV_8U);
+    uchar *base = cv::alignPtr(this->storage.data, 64);
+    this->re = cv::Mat(rows, cols, CV_64F, base, step);
+    this->im = cv::Mat(rows, cols, CV_64F, base + rows * step, step);
+    this->rows = rows;
+    this->cols = cols;
+}
+
+// -drop the planes, to pool when they came from it
+inline void Spectrum::release(Pool *pool)
+{
+    Buffer::Release(pool, this->storage);
+    this->re.release();
+    this->im.release();
+    this->rows = 0;
+    this->cols = 0;
+}
+
+inline Spectrum Spectrum::clone(Pool *pool) const
+{
+    Spectrum copy(this->rows, this->cols, this->shifted, pool);
+    copy.original = this->original;
+    this->re.copyTo(copy.re);
+    this->im.copyTo(copy.im);
+    return copy;
+}
+
+// -CV_64FC2 copy for code that still takes the interleaved layout
+inline cv::Mat Spectrum::Interleave() const
+{
+    cv::Mat complex(this->rows, this->cols, CV_64FC2);
+    for( int i=0; i<this->rows; i++ )
+    {
+        const double *a = this->re.ptr<double>(i);
+        const double *b = this->im.ptr<double>(i);
+        double *p = complex.ptr<double>(i);
+        for( int j=0; j<this->cols; j++ )
+        {
+            p[2*j] = a[j];
+            p[2*j + 1] = b[j];
+        }
+    }
+    return complex;
+}
+
+inline bool Spectrum::empty() const
+{
+    return this->re.empty();
+}
+
+
+// -frequency of row i / column j, measured from the centre when the
+//         spectrum is shifted (FFT2D default)
+inline double Frequency(int i, int size, bool centred)
+{
+    return centred ? i - size / 2 : (i < (size + 1) / 2 ? i : i - size);
+}
+
+// ComplexRows
+// -row access to complex data in either layout, value j of row i is
+//         Re(i)[j*stride] + i Im(i)[j*stride]
+// -a 2 channel Mat gives stride 2 into the one buffer, a Spectrum gives
+//         stride 1 into its two planes, so one loop body serves both
+template< typename T >
+struct ComplexRows
+{
+    ComplexRows(const cv::Mat &complex)
+        : re(complex), im(complex), offset(1), stride(2), rows(complex.rows), cols(complex.cols) {}
+    ComplexRows(const Spectrum &spectrum)
+        : re(spectrum.re), im(spectrum.im), offset(0), stride(1), rows(spectrum.rows), cols(spectrum.cols) {}
+
+    T* Re(int i) const { return (T*)this->re.ptr<T>(i); }
+    T* Im(int i) const { return (T*)this->im.ptr<T>(i) + this->offset; }
+
+    cv::Mat re, im;
+    int offset;
+    int stride;
+    int rows, cols;
+};
+
+#endif
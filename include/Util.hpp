@@ -2,14 +2,26 @@
 #define UTIL_H
 
 #include "Image.hpp"
+#include "Histogram.hpp"
+#include "Metrics.hpp"
+#include "Pool.hpp"
+#include "Spectrum.hpp"
 
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include <cfloat>
 #include <assert.h>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define coeff 2.0
 
+enum SpectrumType {SPEC_MAG = 0, SPEC_LOGMAG = 1, SPEC_PHASE = 2};
+
 namespace Util
 {
     // -normalize values to [0, size]
@@ -28,6 +40,221 @@ namespace Util
         }
     }
 
+    // -fold the min and max of one row of width elements into mn and mx
+    //     -two accumulators keep the compares independent
+    template< typename T >
+    inline void RowMinMax(const T *p, int width, T &mn, T &mx)
+    {
+        T mn1 = mn, mx1 = mx;
+        int j = 0;
+        for( ; j<=width - 2; j+=2 )
+        {
+            mn = std::min(mn, p[j]);
+            mx = std::max(mx, p[j]);
+            mn1 = std::min(mn1, p[j+1]);
+            mx1 = std::max(mx1, p[j+1]);
+        }
+        for( ; j<width; j++ )
+        {
+            mn = std::min(mn, p[j]);
+            mx = std::max(mx, p[j]);
+        }
+        mn = std::min(mn, mn1);
+        mx = std::max(mx, mx1);
+    }
+
+#if defined(__SSE2__)
+    // -SSE2 (always there on x86-64) versions for 8 bit, float and double
+    //         rows, the lanes are folded once at the end of the row
+    inline void RowMinMax(const uchar *p, int width, uchar &mn, uchar &mx)
+    {
+        int j = 0;
+        if( width >= 16 )
+        {
+            __m128i vmn = _mm_set1_epi8((char)mn);
+            __m128i vmx = _mm_set1_epi8((char)mx);
+            for( ; j<=width - 16; j+=16 )
+            {
+                __m128i v = _mm_loadu_si128((const __m128i*)(p + j));
+                vmn = _mm_min_epu8(vmn, v);
+                vmx = _mm_max_epu8(vmx, v);
+            }
+            uchar a[16], b[16];
+            _mm_storeu_si128((__m128i*)a, vmn);
+            _mm_storeu_si128((__m128i*)b, vmx);
+            for( int k=0; k<16; k++ )
+            {
+                mn = std::min(mn, a[k]);
+                mx = std::max(mx, b[k]);
+            }
+        }
+        for( ; j<width; j++ )
+        {
+            mn = std::min(mn, p[j]);
+            mx = std::max(mx, p[j]);
+        }
+    }
+
+    inline void RowMinMax(const float *p, int width, float &mn, float &mx)
+    {
+        int j = 0;
+        if( width >= 4 )
+        {
+            __m128 vmn = _mm_set1_ps(mn);
+            __m128 vmx = _mm_set1_ps(mx);
+            for( ; j<=width - 4; j+=4 )
+            {
+                __m128 v = _mm_loadu_ps(p + j);
+                vmn = _mm_min_ps(vmn, v);
+                vmx = _mm_max_ps(vmx, v);
+            }
+            float a[4], b[4];
+            _mm_storeu_ps(a, vmn);
+            _mm_storeu_ps(b, vmx);
+            for( int k=0; k<4; k++ )
+            {
+                mn = std::min(mn, a[k]);
+                mx = std::max(mx, b[k]);
+            }
+        }
+        for( ; j<width; j++ )
+        {
+            mn = std::min(mn, p[j]);
+            mx = std::max(mx, p[j]);
+        }
+    }
+
+    inline void RowMinMax(const double *p, int width, double &mn, double &mx)
+    {
+        int j = 0;
+        if( width >= 4 )
+        {
+            __m128d mn0 = _mm_set1_pd(mn), mn1 = mn0;
+            __m128d mx0 = _mm_set1_pd(mx), mx1 = mx0;
+            for( ; j<=width - 4; j+=4 )
+            {
+                __m128d v0 = _mm_loadu_pd(p + j);
+                __m128d v1 = _mm_loadu_pd(p + j + 2);
+                mn0 = _mm_min_pd(mn0, v0);
+                mx0 = _mm_max_pd(mx0, v0);
+                mn1 = _mm_min_pd(mn1, v1);
+                mx1 = _mm_max_pd(mx1, v1);
+            }
+            double a[2], b[2];
+            _mm_storeu_pd(a, _mm_min_pd(mn0, mn1));
+            _mm_storeu_pd(b, _mm_max_pd(mx0, mx1));
+            mn = std::min(mn, std::min(a[0], a[1]));
+            mx = std::max(mx, std::max(b[0], b[1]));
+        }
+        for( ; j<width; j++ )
+        {
+            mn = std::min(mn, p[j]);
+            mx = std::max(mx, p[j]);
+        }
+    }
+#endif
+
+    // -min and max over one stripe of rows per index of range, all
+    //         channels together, each stripe writing its own slot
+    template< typename T >
+    class MinMaxBody : public cv::ParallelLoopBody
+    {
+     public:
+        MinMaxBody(const cv::Mat &source, int stripes, double *lo, double *hi)
+            : source(source), stripes(stripes), lo(lo), hi(hi) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int width = source.cols * source.channels();
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)source.rows * s / stripes);
+                int last = (int)((long long)source.rows * (s + 1) / stripes);
+                T mn = source.ptr<T>(first)[0], mx = mn;
+                for( int i=first; i<last; i++ )
+                    RowMinMax(source.ptr<T>(i), width, mn, mx);
+                lo[s] = mn;
+                hi[s] = mx;
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        int stripes;
+        double *lo, *hi;
+    };
+
+    // -min and max of every element of source, reduced per stripe in
+    //         parallel and merged
+    //     -the per stripe slots come from pool when given
+    template< typename T >
+    void MinMax(const cv::Mat &source, double &min, double &max, Pool *pool = NULL)
+    {
+        min = max = 0.0;
+        if( source.empty() )
+            return;
+        int stripes = std::max(1, std::min(cv::getNumThreads(), source.rows));
+        cv::Mat slots = Buffer::Acquire(pool, 2, stripes, CV_64F);
+        double *lo = slots.ptr<double>(0);
+        double *hi = slots.ptr<double>(1);
+        cv::parallel_for_(cv::Range(0, stripes), MinMaxBody<T>(source, stripes, lo, hi), stripes);
+        min = *std::min_element(lo, lo + stripes);
+        max = *std::max_element(hi, hi + stripes);
+        Buffer::Release(pool, slots);
+    }
+
+    // -write (v - min) * (hi - lo)/(max - min) + lo saturated to 8 bits
+    template< typename T >
+    class NormalizeBody : public cv::ParallelLoopBody
+    {
+     public:
+        NormalizeBody(const cv::Mat &source, cv::Mat &dest, double scale, double shift)
+            : source(source), dest(dest), scale(scale), shift(shift) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int width = source.cols * source.channels();
+            for( int i=range.start; i<range.end; i++ )
+            {
+                const T *s = source.ptr<T>(i);
+                uchar *d = dest.ptr<uchar>(i);
+                for( int j=0; j<width; j++ )
+                    d[j] = cv::saturate_cast<uchar>(s[j] * scale + shift);
+            }
+        }
+
+     private:
+        const cv::Mat &source;
+        cv::Mat &dest;
+        double scale, shift;
+    };
+
+    // -map [min, max] of source onto [lo, hi] in an 8 bit dest in one pass
+    //     -min and max are given so tiles of one image can share the bounds
+    //     -dest is written in place when it already has the right size and
+    //             type and is not source, otherwise it is reallocated
+    template< typename T >
+    void NormalizeTo8U(const cv::Mat &source, cv::Mat &dest, double lo, double hi, double min, double max)
+    {
+        double scale = max > min ? (hi - lo) / (max - min) : 0.0;
+        double shift = lo - min * scale;
+        cv::Mat out = dest;
+        if( out.data == source.data || out.size() != source.size() || out.type() != CV_8UC(source.channels()) )
+            out = cv::Mat(source.rows, source.cols, CV_8UC(source.channels()));
+        cv::parallel_for_(cv::Range(0, source.rows), NormalizeBody<T>(source, out, scale, shift));
+        dest = out;
+    }
+
+    // -map the range of source onto [lo, hi] in an 8 bit dest
+    //     -one parallel reduction for min and max, one pass to convert
+    template< typename T >
+    void NormalizeTo8U(const cv::Mat &source, cv::Mat &dest, double lo, double hi)
+    {
+        double min, max;
+        MinMax<T>(source, min, max);
+        NormalizeTo8U<T>(source, dest, lo, hi, min, max);
+    }
+
     template< typename T>
     void Shift(cv::Mat& source)
     {
@@ -40,32 +267,247 @@ namespace Util
                 }
     }
 
-    template< typename T>
-    cv::Mat Magnitude(const cv::Mat& source, double c, bool log) 
+    // -natural log from the exponent and a short series on the mantissa
+    //         m in [1, 2): log m = 2 atanh((m-1)/(m+1)), relative error ~1e-4
+    inline double FastLog(double x)
     {
-        cv::vector<cv::Mat> channels(2);
-        cv::Mat mag, reSqr, imSqr;
-        cv::Mat logMag;
+        union { double d; long long i; } u;
+        u.d = x;
+        int e = (int)((u.i >> 52) & 0x7ff) - 1023;
+        u.i = (u.i & 0x000fffffffffffffLL) | 0x3ff0000000000000LL;
+        double t = (u.d - 1.0) / (u.d + 1.0);
+        double t2 = t * t;
+        return 2.0 * t * (1.0 + t2 * (1.0/3.0 + t2 * 0.2)) + e * 0.69314718055994531;
+    }
+
+    // -polynomial atan on the octant then mirrored, error ~2e-4 rad
+    inline double FastAtan2(double y, double x)
+    {
+        double ax = fabs(x);
+        double ay = fabs(y);
+        double hi = std::max(ax, ay);
+        if( hi == 0.0 )
+            return 0.0;
+        double a = std::min(ax, ay) / hi;
+        double s = a * a;
+        double r = ((-0.0464964749 * s + 0.15931422) * s - 0.327622764) * s * a + a;
+        if( ay > ax )
+            r = M_PI / 2.0 - r;
+        if( x < 0.0 )
+            r = M_PI - r;
+        return y < 0.0 ? -r : r;
+    }
+
+    // -magnitude, log(c * (magnitude + 1)) or phase of one complex value
+    inline double SpectrumValue(double re, double im, SpectrumType type, double c, bool fast)
+    {
+        switch(type)
+        {
+            case(SPEC_PHASE):
+                return fast ? FastAtan2(im, re) : atan2(im, re);
+            case(SPEC_LOGMAG):
+            {
+                double v = c * (sqrt(re*re + im*im) + 1.0);
+                return fast ? FastLog(v) : log(v);
+            }
+            default:
+                return sqrt(re*re + im*im);
+        }
+    }
+
+    // -min and max of the spectrum value over one stripe of rows per index
+    //         of range, nothing is stored
+    template< typename T >
+    class SpectrumRangeBody : public cv::ParallelLoopBody
+    {
+     public:
+        SpectrumRangeBody(const ComplexRows<T> &source, SpectrumType type, double c, bool fast, int stripes, double *lo, double *hi)
+            : source(source), type(type), c(c), fast(fast), stripes(stripes), lo(lo), hi(hi) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            for( int s=range.start; s<range.end; s++ )
+            {
+                int first = (int)((long long)source.rows * s / stripes);
+                int last = (int)((long long)source.rows * (s + 1) / stripes);
+                double mn = DBL_MAX, mx = -DBL_MAX;
+                const int stride = source.stride;
+                for( int i=first; i<last; i++ )
+                {
+                    const T *a = source.Re(i);
+                    const T *b = source.Im(i);
+                    for( int j=0; j<source.cols; j++ )
+                    {
+                        double v = SpectrumValue(a[j*stride], b[j*stride], type, c, fast);
+                        mn = std::min(mn, v);
+                        mx = std::max(mx, v);
+                    }
+                }
+                lo[s] = mn;
+                hi[s] = mx;
+            }
+        }
+
+     private:
+        const ComplexRows<T> &source;
+        SpectrumType type;
+        double c;
+        bool fast;
+        int stripes;
+        double *lo, *hi;
+    };
+
+    // -dest = value * scale + shift straight from the complex source in
+    //         either layout, dest is CV_64F or CV_8U (saturated)
+    template< typename T >
+    class SpectrumBody : public cv::ParallelLoopBody
+    {
+     public:
+        SpectrumBody(const ComplexRows<T> &source, cv::Mat &dest, SpectrumType type, double c, bool fast, double scale, double shift)
+            : source(source), dest(dest), type(type), c(c), fast(fast), scale(scale), shift(shift) {}
+
+        void operator()(const cv::Range &range) const
+        {
+            const int stride = source.stride;
+            for( int i=range.start; i<range.end; i++ )
+            {
+                const T *a = source.Re(i);
+                const T *b = source.Im(i);
+                if( dest.depth() == CV_8U )
+                {
+                    uchar *d = dest.ptr<uchar>(i);
+                    for( int j=0; j<source.cols; j++ )
+                        d[j] = cv::saturate_cast<uchar>(SpectrumValue(a[j*stride], b[j*stride], type, c, fast) * scale + shift);
+                }
+                else
+                {
+                    double *d = dest.ptr<double>(i);
+                    for( int j=0; j<source.cols; j++ )
+                        d[j] = SpectrumValue(a[j*stride], b[j*stride], type, c, fast) * scale + shift;
+                }
+            }
+        }
+
+     private:
+        const ComplexRows<T> &source;
+        cv::Mat &dest;
+        SpectrumType type;
+        double c;
+        bool fast;
+        double scale, shift;
+    };
+
+    // -range of the spectrum value over the whole source
+    //     -the per stripe slots come from pool when given
+    template< typename T >
+    void SpectrumRange(const ComplexRows<T> &source, SpectrumType type, double c, bool fast, double &min, double &max, Pool *pool = NULL)
+    {
+        int stripes = std::max(1, std::min(cv::getNumThreads(), source.rows));
+        cv::Mat slots = Buffer::Acquire(pool, 2, stripes, CV_64F);
+        double *lo = slots.ptr<double>(0);
+        double *hi = slots.ptr<double>(1);
+        cv::parallel_for_(cv::Range(0, stripes), SpectrumRangeBody<T>(source, type, c, fast, stripes, lo, hi), stripes);
+        min = *std::min_element(lo, lo + stripes);
+        max = *std::max_element(hi, hi + stripes);
+        Buffer::Release(pool, slots);
+    }
+
+    template< typename T >
+    void SpectrumRange(const cv::Mat &source, SpectrumType type, double c, bool fast, double &min, double &max, Pool *pool = NULL)
+    {
+        SpectrumRange<T>(ComplexRows<T>(source), type, c, fast, min, max, pool);
+    }
+
+    // -magnitude, log magnitude or phase of complex rows into a CV_64F
+    //         dest, or min-max scaled to [0, 255] in a CV_8U dest with the
+    //         range found in a first pass that stores nothing
+    template< typename T >
+    void SpectrumRows(const ComplexRows<T> &source, cv::Mat &dest, SpectrumType type, double c, bool fast, int depth)
+    {
+        double scale = 1.0, shift = 0.0;
+        if( depth == CV_8U )
+        {
+            double min, max;
+            SpectrumRange<T>(source, type, c, fast, min, max);
+            scale = max > min ? 255.0 / (max - min) : 0.0;
+            shift = -min * scale;
+        }
+        dest.create(source.rows, source.cols, depth);
+        cv::parallel_for_(cv::Range(0, source.rows), SpectrumBody<T>(source, dest, type, c, fast, scale, shift));
+    }
+
+    // -magnitude, log magnitude or phase of a 2 channel complex Mat of T
+    //         (float or double) into a CV_64F dest in one pass
+    //     -fast swaps log and atan2 for the approximations above
+    template< typename T >
+    void Spectrum(const cv::Mat &source, cv::Mat &dest, SpectrumType type, double c = 1.0, bool fast = false)
+    {
+        CV_Assert(source.channels() == 2);
+        SpectrumRows<T>(ComplexRows<T>(source), dest, type, c, fast, CV_64F);
+    }
+
+    inline void Spectrum(const ::Spectrum &source, cv::Mat &dest, SpectrumType type, double c = 1.0, bool fast = false)
+    {
+        SpectrumRows<double>(ComplexRows<double>(source), dest, type, c, fast, CV_64F);
+    }
+
+    // -as Spectrum but min-max scaled to [0, 255] in an 8 bit dest
+    template< typename T >
+    void SpectrumTo8U(const cv::Mat &source, cv::Mat &dest, SpectrumType type, double c = 1.0, bool fast = false)
+    {
+        CV_Assert(source.channels() == 2);
+        SpectrumRows<T>(ComplexRows<T>(source), dest, type, c, fast, CV_8U);
+    }
+
+    inline void SpectrumTo8U(const ::Spectrum &source, cv::Mat &dest, SpectrumType type, double c = 1.0, bool fast = false)
+    {
+        SpectrumRows<double>(ComplexRows<double>(source), dest, type, c, fast, CV_8U);
+    }
+
+    // -magnitude of complex rows, or log(c * (magnitude + 1)) normalized
+    //         to [0, 1] when log is set
+    //     -the result comes from pool when one is given, give it back with
+    //             pool->Release once done
+    template< typename T >
+    cv::Mat MagnitudeRows(const ComplexRows<T> &source, double c, bool log, Pool *pool = NULL)
+    {
+        cv::Mat mag = Buffer::Acquire(pool, source.rows, source.cols, CV_64F);
+        SpectrumType type = log ? SPEC_LOGMAG : SPEC_MAG;
+        double scale = 1.0;
+        double shift = 0.0;
 
-        cv::split(source, channels);
-        cv::multiply(channels[0], channels[0], reSqr);
-        cv::multiply(channels[1], channels[1], imSqr);
-        cv::sqrt(reSqr + imSqr, mag);
-       
         if(log)
         {
-            cv::log(c * cv::abs(mag + 1), logMag);
-            Util::Normalize<double>(logMag, cv::Scalar(1.0), 0);
-            return logMag;
+            double min, max;
+            SpectrumRange<T>(source, type, c, false, min, max, pool);
+            scale = max > min ? 1.0 / (max - min) : 0.0;
+            shift = -min * scale;
         }
-        else
-            return mag;
+
+        cv::parallel_for_(cv::Range(0, source.rows), SpectrumBody<T>(source, mag, type, c, false, scale, shift));
+        return mag;
+    }
+
+    // -magnitude of a complex Mat, or log(c * (magnitude + 1)) normalized
+    //         to [0, 1] when log is set, from pool when one is given
+    template< typename T>
+    cv::Mat Magnitude(const cv::Mat& source, double c, bool log, Pool *pool = NULL) 
+    {
+        if( source.depth() == CV_32F )
+            return MagnitudeRows<float>(ComplexRows<float>(source), c, log, pool);
+        return MagnitudeRows<double>(ComplexRows<double>(source), c, log, pool);
+    }
+
+    inline cv::Mat Magnitude(const ::Spectrum &source, double c, bool log, Pool *pool = NULL)
+    {
+        return MagnitudeRows<double>(ComplexRows<double>(source), c, log, pool);
     }
 
     template< typename T>
-    void PadImage(cv::Mat& padded, const cv::Mat &source, int padX, int padY)
+    void PadImage(cv::Mat& padded, const cv::Mat &source, int padX, int padY, Pool *pool = NULL)
     {
-        padded = cv::Mat( source.rows + padY, source.cols + padX, source.type(), cv::Scalar(0.0, 0.0, 0.0));
+        padded = Buffer::Acquire(pool, source.rows + padY, source.cols + padX, source.type());
+        padded.setTo(cv::Scalar(0.0, 0.0, 0.0));
         cv::Mat roi = padded(cv::Rect(padX/2, padY/2, source.cols, source.rows));
         source.copyTo(roi);
     }
@@ -130,38 +572,45 @@ namespace Util
     }
 
 
+    // -squared error normalized by size^2 summed over the channel,
+    //         squareError holds the mean of each column for plotting
     template< class T >
     double ComputeSquareError(const cv::Mat &source, const cv::Mat &compare, cv::Mat &squareError, int size, int channel)
     {
-        squareError = cv::Mat(1, size, CV_64FC1);
-        double sum = 0;
+        squareError = cv::Mat(1, std::max(size, source.cols), CV_64FC1, cv::Scalar(0.0));
         if(source.cols != compare.cols || source.rows != compare.rows)
         {
             std::cout<< "Images must have the same dimension";
-            return sum;
+            return 0.0;
+        }
+
+        cv::Mat map;
+        Metrics::Compare<T>(source, compare, &map);
+        const int cn = source.channels();
+        const double norm = 1.0 / ((double)size * size);
+        double sum = 0.0;
+        for( int i=0; i<map.rows; i++ )
+        {
+            const double *m = map.ptr<double>(i) + channel;
+            for( int j=0; j<map.cols; j++ )
+                squareError.at<double>(0, j) += m[j*cn] * norm;
+        }
+        for( int j=0; j<map.cols; j++ )
+        {
+            sum += squareError.at<double>(0, j);
+            squareError.at<double>(0, j) /= map.rows;
         }
-        for( int i=0; i<source.rows; i++ )
-            for( int j=0; j<source.cols; j++ )
-            {
-                squareError.at<double>(0, j) = (double)pow(source.at<uchar>(i, j, channel) - compare.at<uchar>(i, j, channel), 2) / pow(size, 2);
-                sum += squareError.at<double>(0, j);
-            }
         return sum; 
     }
 
     // -define histogram as size = image depth
-    // -iterate through each location (xsrc,ysrc) in the source image
-    //         and increment histogram at truncated value of pixel
-    //     -normalize the histogram H = H * 1/MN
+    // -count each value of the channel into integer bins (Histogram::Count)
+    //     -normalize the histogram H = H * 1/MN, the CDF row is filled
+    //             from the same counts
     template< typename T > 
     void PDF(cv::Mat &histogram, const cv::Mat &source, int channel)
     {
-        for( int i=0; i<source.rows; i++ )
-            for( int j=0; j<source.cols; j++ )
-            {
-                histogram.at<double>(0,(int)source.at<uchar>(i,j,channel))++;
-            }
-        histogram.row(0) *= ( 1.0 / (source.rows * source.cols));
+        Histogram::Create(histogram, source, channel);
     }
 
     // -iterate through each location in the histogram 
@@ -33,6 +33,8 @@ int project1(int argc, char* argv[])
             "\t Interpolation Options: 1. <1> for nearest neighbor\n"
             "\t\t 2. <2> for averaging\n"
             "\t\t 3. <3> for bilinear interpolation\n"
+            "\t\t 4. <4> for bicubic interpolation\n"
+            "\t\t 5. <5> for lanczos3 interpolation\n"
             "\t\t\t Transform Options: 1. <1> <angle> for rotate\n"
             "\t\t\t 2. <2> <x> <y> for translate\n"
             "\t\t\t 3. <3> <x> <y> for scale\n"
@@ -107,13 +109,16 @@ int testInterpolate(Image<T> &image, const char* outfile, int option, double sx,
     trans = AffineTransform::Scale(1.0/sx, 1.0/sy);
     xsize = image.source.cols * (1.0/sx);
     ysize = image.source.rows * (1.0/sy);
-    AffineTransform::Transform<T>(image.source, trans, xsize, ysize, (InterpolateType)1);
+    AffineTransform::Warp<T>(image.source, trans, xsize, ysize, (InterpolateType)1);
     trans = AffineTransform::Scale(sx, sy);
     xsize = image.source.cols * sx;
     ysize = image.source.rows * sy;
-    AffineTransform::Transform<T>(image.source, trans, xsize, ysize, (InterpolateType)option);
+    AffineTransform::Warp<T>(image.source, trans, xsize, ysize, (InterpolateType)option);
     double err = Util::ComputeSquareError<uchar>(image.source, orig.source, image.squareError, size, channel);
     cout<< "Err from " << outfile << option<< "= "<< err <<endl;
+    if( image.source.size() == orig.source.size() )
+        cout<< "PSNR = " << Metrics::PSNR<uchar>(image.source, orig.source)
+            << "  SSIM = " << Metrics::SSIM<uchar>(image.source, orig.source, channel) << endl;
 
     ostringstream sout;
     sout << "img/interpolate/" << outfile << msg << option << ".png";
@@ -177,7 +182,7 @@ int testAffine(Image<T> &image, const char* outfile, int op1, int op2, double x,
             msg = "sheary";
             break;
     }
-    AffineTransform::Transform(image.source, trans, xsize, ysize, (InterpolateType)op1);
+    AffineTransform::Warp<T>(image.source, trans, xsize, ysize, (InterpolateType)op1);
    
     ostringstream sout;
     sout << "img/affine/" << outfile << msg << op1 << ".png";
@@ -200,6 +205,9 @@ int testEqualization(Image<T> &image, const char* outfile)
     IntensityTransform::CreateHistogram<T>(image.histogram, image.source, channel);
     Image<uchar> histographPDF(image.histogram, 400, 400, 256, HPDF);
     Image<uchar> histographCDF(image.histogram, 400, 400, 256, HCDF);
+
+    cv::Mat adaptive = image.source.clone();
+    IntensityTransform::AdaptiveEqualize<T>(adaptive, 8, 8, 3.0, channel);
     
     IntensityTransform::Equalize<T>(image.source, size, channel);
 
@@ -220,6 +228,10 @@ int testEqualization(Image<T> &image, const char* outfile)
     cout << "Writing image to " << sout.str() << endl;
     imwrite(sout.str().c_str(), image.source);
     sout.str("");
+    sout << "img/equalize/" << outfile << "clahe.png";
+    cout << "Writing image to " << sout.str() << endl;
+    imwrite(sout.str().c_str(), adaptive);
+    sout.str("");
     sout << "img/equalize/" << outfile << "pdf_out.png";
     cout << "Writing image to " << sout.str() << endl;
     imwrite(sout.str().c_str(), histographPDF2.source);
@@ -5,6 +5,7 @@
 #include "AffineTransform.hpp"
 #include "Filter.hpp"
 #include "Noise.hpp"
+#include "Match.hpp"
 
 using namespace std;
 using namespace cv;
@@ -27,6 +28,9 @@ int testSharpening(Image<T>&, MasqueType, const char*);
 template< class T >
 int testUnsharpening(Image<T>&, const char*, double);
 
+template< class T >
+int testLibrary(Image<T>&, vector<cv::Mat>&);
+
 
 int project2(int argc, char* argv[])
 {
@@ -47,6 +51,7 @@ int project2(int argc, char* argv[])
             "\t\t\t     3. <2> for Laplacian Filter\n\n"
             "\t 6. <image> <outfile> <6> <A> for Unsharpening (High Boost/Low Pass)\n"
             "\t (A = 1 for High Pass Filter)\n\n"
+            "\t 7. <image> <outfile> <7> <pattern> (<pattern> ...) for Multi-Pattern Matching\n\n"
             "\tExample: ./process_image boat.png boatSmooth15x15 2 15 (smooth boat using Gaussian 15x15)"<<endl; 
         return -1;
     }
@@ -83,6 +88,22 @@ int project2(int argc, char* argv[])
     
     if(atoi(argv[3]) == 6)
         testUnsharpening(image, argv[2], (double)atof(argv[4]));
+
+    if(atoi(argv[3]) == 7)
+    {
+        vector<cv::Mat> patterns;
+        for(int k=4; k<argc; k++)
+        {
+            Image<uchar> pattern(argv[k], GRAY);
+            if(! pattern.source.data )
+            {
+                cout <<  "Could not open or find the image" << std::endl ;
+                return -1;
+            }
+            patterns.push_back(pattern.source);
+        }
+        testLibrary(image, patterns);
+    }
  
     waitKey(0);
     return 0;
@@ -91,9 +112,24 @@ int project2(int argc, char* argv[])
 template< class T >
 int testCorrelation(Image<T> &image, Image<T> &masque, const char* outfile)
 {
-    Filter::Correlation<T>(image.source, masque.source, true, true);
+    // normalized matches first, the raw correlation below overwrites the
+    //         image
+    cv::Mat scores;
+    vector<Filter::Peak> matches = Match::Template<T>(image.source, masque.source, 3, -1, &scores);
+    for( size_t k=0; k<matches.size(); k++ )
+        cout << "Match at (" << matches[k].x << ", " << matches[k].y << ") score " << matches[k].value << endl;
 
     ostringstream sout;
+    cv::Mat ncc;
+    Util::NormalizeTo8U<double>(scores, ncc, 0.0, 255.0);
+    sout << "img/filter/" << outfile << "ncc.png";
+    cout << "Writing image to " << sout.str() << endl;
+    imwrite(sout.str().c_str(), ncc);
+    sout.str("");
+    imshow("NCC", ncc);
+
+    Filter::Correlation<T>(image.source, masque.source, true, true);
+
     sout << "img/filter/" << outfile << ".png";
     cout << "Writing image to " << sout.str() << endl;
     imwrite(sout.str().c_str(), image.source);
@@ -183,7 +219,6 @@ int testAveraging(Image<T> &image, int filterSize, const char* outfile, int perc
 template< class T >
 int testSharpening(Image<T> &image, MasqueType type, const char* outfile)
 {
-    int channel = 0;
     cv::Mat masque;
     string msg = "";
     switch(type)
@@ -231,8 +266,7 @@ int testSharpening(Image<T> &image, MasqueType type, const char* outfile)
         cv::sqrt(gradient, gradient);
         msg = "_gradient";
 
-        Util::Normalize<T>(gradient, Scalar(255.0), channel);
-        gradient.convertTo(image.source, image.source.type(), 1.0);
+        Util::NormalizeTo8U<double>(gradient, image.source, 0.0, 255.0);
         
         sout << "img/filter/" << outfile << msg <<"grad.png";
         cout << "Writing image to " << sout.str() << endl;
@@ -301,4 +335,18 @@ int testUnsharpening(Image<T> &image, const char* outfile, double A)
     return 0;
 }
 
+template< class T >
+int testLibrary(Image<T> &image, vector<cv::Mat> &patterns)
+{
+    Match::Library<T> library;
+    for( size_t n=0; n<patterns.size(); n++ )
+        library.Add(patterns[n]);
+
+    vector< vector<Filter::Peak> > matches = library.Search(image.source, 3);
+    for( size_t n=0; n<matches.size(); n++ )
+        for( size_t k=0; k<matches[n].size(); k++ )
+            cout << "Pattern " << n << " at (" << matches[n][k].x << ", " << matches[n][k].y
+                << ") score " << matches[n][k].value << endl;
 
+    return 0;
+}
@@ -133,9 +133,9 @@ int project3(int argc, char* argv[])
 template< class T >
 int experiment1(Image<T> &image, const char* outfile)
 {
-    cv::Mat fft = FFT::FFT2D<T>(image.source, -1);
+    Spectrum fft = FFT::Forward<T>(image.source);
 
-    cout<<"FFT\n" <<fft<<endl;
+    cout<<"FFT\n" <<fft.Interleave()<<endl;
 
     ostringstream sout;
     Image<uchar> re(fft, 400, 400, 128, RE);
@@ -162,9 +162,9 @@ int experiment1(Image<T> &image, const char* outfile)
     imwrite(sout.str().c_str(), mag.source);
     sout.str("");
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
+    Spectrum invfft = FFT::Inverse(fft);
  
-    cout<<"INVFFT\n"<<invfft<<endl;
+    cout<<"INVFFT\n"<<invfft.Interleave()<<endl;
 
     return 0;
 }
@@ -174,47 +174,30 @@ int experiment1(Image<T> &image, const char* outfile)
 template< class T >
 int experiment2(Image<T> &image, const char* outfile)
 {
-    cv::Mat fft = FFT::FFT2D<T>(image.source, -1, false);
+    Spectrum fft = FFT::Forward<T>(image.source, false);
     ostringstream sout;
-    vector<cv::Mat> channels(2);
-    cv::split(fft, channels);
 
-    cv::Mat mag, reSqr, imSqr;
-    cv::multiply(channels[0], channels[0], reSqr);
-    cv::multiply(channels[1], channels[1], imSqr);
-    cv::sqrt(reSqr + imSqr, mag);
-    
-    cv::Mat logMag;
-    cv::log(cv::abs(mag + 1), logMag);
-    Util::Normalize<double>(logMag, Scalar(1500.0), 0);
+    cv::Mat logMag = Util::Magnitude(fft, 1.0, true);
     imshow("FFT Unshifted (DBL)", logMag);
-    logMag.convertTo(logMag, CV_8UC1);
-    Util::Normalize<uchar>(logMag, Scalar(255.0), 0);
+    Util::SpectrumTo8U(fft, logMag, SPEC_LOGMAG);
     imshow("FFT Unshifted", logMag);
     sout << "img/fft/" << outfile <<"unshifted.png";
     cout << "Writing image to " << sout.str() << endl;
     imwrite(sout.str().c_str(), logMag);
     sout.str("");
 
-    fft = FFT::FFT2D<T>(image.source, -1);
+    fft = FFT::Forward<T>(image.source);
 
-    cv::split(fft, channels);
-    cv::multiply(channels[0], channels[0], reSqr);
-    cv::multiply(channels[1], channels[1], imSqr);
-    cv::sqrt(reSqr + imSqr, mag);
-    
-    cv::log(cv::abs(mag + 1), logMag);
-    Util::Normalize<double>(logMag, Scalar(1500.0), 0);
+    logMag = Util::Magnitude(fft, 1.0, true);
     imshow("FFT Shifted (DBL)", logMag);
-    logMag.convertTo(logMag, CV_8UC1);
-    Util::Normalize<uchar>(logMag, Scalar(255.0), 0);
+    Util::SpectrumTo8U(fft, logMag, SPEC_LOGMAG);
     imshow("FFT Shifted", logMag);
     sout << "img/fft/" << outfile <<"shifted.png";
     cout << "Writing image to " << sout.str() << endl;
     imwrite(sout.str().c_str(), logMag);
     sout.str("");
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
+    Spectrum invfft = FFT::Inverse(fft);
  
     return 0;
 }
@@ -223,58 +206,52 @@ int experiment2(Image<T> &image, const char* outfile)
 template< class T >
 int experiment3(Image<T> &image)
 {
-    cv::Mat fft = FFT::FFT2D<T>(image.source, -1);
+    Spectrum fft = FFT::Forward<T>(image.source);
     ostringstream sout;
-    vector<cv::Mat> channels(2);
-    cv::split(fft, channels);
-
-    cv::Mat zeros(fft.rows, fft.cols, CV_64FC1, Scalar(0.0));
-    cv::Mat mag, reSqr, imSqr;
-    cv::multiply(channels[0], channels[0], reSqr);
-    cv::multiply(channels[1], channels[1], imSqr);
-    cv::sqrt(reSqr + imSqr, mag);
-    channels[0] = mag.clone();
-    channels[1] = zeros.clone();
-    cv::merge(channels, fft);
-    
-    cv::Mat logMag;
-    cv::log(cv::abs(mag + 1), logMag);
-    Util::Normalize<double>(logMag, Scalar(1.0), 0);
+
+    cv::Mat logMag = Util::Magnitude(fft, 1.0, true);
+
+    cv::Mat mag;
+    Util::Spectrum(fft, mag, SPEC_MAG);
+    mag.copyTo(fft.re);
+    fft.im.setTo(Scalar(0.0));
 
     imshow("FFT", logMag);
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
-    cv::split(invfft, channels);
+    Spectrum invfft = FFT::Inverse(fft);
 
-    channels[0].convertTo(channels[0], CV_8UC1);
-    imshow("INVFFT Zero Phase", channels[0]);
+    cv::Mat img;
+    invfft.re.convertTo(img, CV_8UC1);
+    imshow("INVFFT Zero Phase", img);
     sout << "img/fft/zerophase.png";
     cout << "Writing image to " << sout.str() << endl;
-    imwrite(sout.str().c_str(), channels[0]);
+    imwrite(sout.str().c_str(), img);
     sout.str("");
 
-    fft = FFT::FFT2D<T>(image.source, -1);
+    fft = FFT::Forward<T>(image.source);
 
-    cv::split(fft, channels);
+    cv::Mat phase;
+    Util::Spectrum(fft, phase, SPEC_PHASE);
 
     for( int i=0; i<fft.rows; i++ )
+    {
+        const double *theta = phase.ptr<double>(i);
+        double *re = fft.re.ptr<double>(i);
+        double *im = fft.im.ptr<double>(i);
         for( int j=0; j<fft.cols; j++ )
         {
-            double theta = atan2(channels[1].at<double>(i, j), channels[0].at<double>(i, j));
-            fft.at<Vec2d>(i,j)[0] = cos(theta);
-            fft.at<Vec2d>(i,j)[1] = sin(theta);
+            re[j] = cos(theta[j]);
+            im[j] = sin(theta[j]);
         }
+    }
 
-    invfft = FFT::FFT2D<Vec2d>(fft, 1);
-    Util::Normalize<double>(invfft, Scalar(1.0), 0);
-    cv::split(invfft, channels);
-    
-    channels[0].convertTo(channels[0], CV_8UC1);
-    Util::Normalize<uchar>(channels[0], Scalar(255.0), 0);
-    imshow("INVFFT Magnitude 1", channels[0]);
+    invfft = FFT::Inverse(fft);
+    Util::NormalizeTo8U<double>(invfft.re, img, 0.0, 255.0);
+
+    imshow("INVFFT Magnitude 1", img);
     sout << "img/fft/magone.png";
     cout << "Writing image to " << sout.str() << endl;
-    imwrite(sout.str().c_str(), channels[0]);
+    imwrite(sout.str().c_str(), img);
     sout.str("");
 
  
@@ -6,6 +6,8 @@
 #include "Filter.hpp"
 #include "Noise.hpp"
 #include "FFT.hpp"
+#include "Restore.hpp"
+#include "Register.hpp"
 
 using namespace std;
 using namespace cv;
@@ -19,10 +21,8 @@ int experiment2(Image<T>&, const char*);
 template< class T >
 int experiment3(Image<T>&, const char*);
 
-inline double h(double a, double b, double t, int i, int j) 
-{
-    return (t / (M_PI*(i*a + j*b)))*sin(M_PI*(i*a + j*b))*exp(-j*M_PI*(i*a + j*b));
-}
+template< class T >
+int experiment4(Image<T>&, const char*);
 
 int project4(int argc, char* argv[])
 {
@@ -31,7 +31,8 @@ int project4(int argc, char* argv[])
         cout <<" Usage: process_image <experiment> <num> (options)\n\n"
             "Options: 1. <1> Noise Removal (experiment 1)\n\n "
             "\t 2. <2> Edge Detection (experiment 2)\n"
-            "\t 2. <3> Phase / Magnitude (experiment 3)\n";
+            "\t 2. <3> Phase / Magnitude (experiment 3)\n"
+            "\t 2. <4> Registration (experiment 4)\n";
         return -1;
     }
     
@@ -53,7 +54,7 @@ int project4(int argc, char* argv[])
         cv::merge(channels, image.source);
         experiment1(image, string("boynoisy").c_str());
     }
-    if(atoi(argv[1]) == 2 || atoi(argv[1]) == 3)
+    if(atoi(argv[1]) >= 2 && atoi(argv[1]) <= 4)
     {
         Image<uchar> lenna("./bin/assets/lenna.pgm", GRAY);   
         if(! lenna.source.data )                              
@@ -73,6 +74,8 @@ int project4(int argc, char* argv[])
             experiment2(image, string("lenna").c_str());
         if(atoi(argv[1]) == 3)
             experiment3(image, string("lenna").c_str());
+        if(atoi(argv[1]) == 4)
+            experiment4(image, string("lenna").c_str());
 
     }
    
@@ -85,58 +88,38 @@ template< class T >
 int experiment1(Image<T> &image, const char* outfile)
 {
     ostringstream sout;
-    cv::Point max;
-    cv::Mat mag, logMag;
-    vector<cv::Mat> channels(2);
-
-    cv::Mat fft = FFT::FFT2D<T>(image.source, -1);
-    logMag = Util::Magnitude<double>(fft, 200.0, true);
 
-    cv::Mat roiQ1 = logMag(cv::Rect(0, 0, logMag.rows/2, logMag.cols/2));
+    Spectrum fft = FFT::Forward<T>(image.source);
 
     sout << "img/fft2/fftboy_noisy.png";
     cout << "Writing image to " << sout.str() << endl;
-    cv::split(fft, channels);
-    cv::Mat img = channels[0];
-    Util::Normalize<double>(img, Scalar(255.0), 0);
-    img.convertTo(img, CV_8UC1);
+    cv::Mat img;
+    Util::NormalizeTo8U<double>(fft.re, img, 0.0, 255.0);
     imshow("FFT", img);
     imwrite(sout.str().c_str(), img);
     sout.str("");
 
-    cv::minMaxLoc(roiQ1, NULL, NULL, NULL, &max);
-    double x = fft.cols/2.0 - max.x;
-    double y = fft.rows/2.0 - max.y;
-    double dist = sqrt(x*x + y*y);
-
-    Mat fftTemp = fft.clone();
-    cv::Mat filter = Filter::Band(0, dist/2, fft.cols, fft.rows, true);
-    fftTemp = fft.mul(filter);
-    
-    mag = Util::Magnitude<double>(fftTemp, 20.0, false);
+    // the noise is the sinusoids on the peak samples, zero them and take
+    //         those sinusoids off the noisy image instead of running a
+    //         full inverse transform
+    // the radius kept clear of the centre is derived by FindPeaks from
+    //         the strongest component of the first quadrant
+    std::vector<Filter::Peak> peaks = Filter::FindPeaks(fft, 2, 3, -1.0);
+    Spectrum clean(fft.rows, fft.cols, false);
+    FFT::Fill<T>(image.source, clean, false);
+    FFT::Edits edits(fft, clean);
+    for( size_t k=0; k<peaks.size(); k++ )
+        edits.Set(peaks[k].y, peaks[k].x, 0.0, 0.0);
+    edits.Apply();
 
-    for ( int i = 0; i < 4; ++i )
-    {
-        cv::minMaxLoc(mag, NULL, NULL, NULL, &max);
-        mag.at<double>(max) = 0.0;
-        fft.at<Vec2d>(max) = Interpolate::Average<Vec2d>(fft, cv::Mat(max));
-    }
-
-    logMag = Util::Magnitude<double>(fft, 20.0, true);
     sout << "img/fft2/fftboy.png";
     cout << "Writing image to " << sout.str() << endl;
-    cv::split(fft, channels);
-    img = channels[0];
-    img.convertTo(img, CV_8UC1);
+    fft.re.convertTo(img, CV_8UC1);
     imwrite(sout.str().c_str(), img);
     imshow("FFT Clean", img);
     sout.str("");
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
-
-    cv::split(invfft, channels);
-    img = channels[0];
-    img.convertTo(img, CV_8UC1);
+    clean.re(cv::Rect(0, 0, image.source.cols, image.source.rows)).convertTo(img, CV_8UC1);
     imshow("InvFFT", img);
     sout << "img/fft2/boy.png";
     cout << "Writing image to " << sout.str() << endl;
@@ -151,49 +134,31 @@ int experiment2(Image<T> &image, const char* outfile)
 {
     ostringstream sout;
     cv::Point max;
-    cv::Mat mag, logMag, sobel;
-    vector<cv::Mat> channels(2), sobelchannels(2);
-    cv::Mat tmp = Filter::Sobel();
-    tmp = tmp.t();
-    cv::Mat zeros(tmp.rows, tmp.cols, CV_64FC1, cv::Scalar(0.0));
-    channels[0] = tmp.clone();
-    channels[1] = zeros.clone();
-    cv::merge(channels, sobel);
-    cv::Mat srcPadded, sobelPadded;
-
-    Util::PadImage<T>(srcPadded, image.source, 256, 256);
-    Util::PadImage<Vec2d>(sobelPadded, sobel, 509, 509);
-
-    cv::Mat fft = FFT::FFT2D<T>(srcPadded, -1);
-    cv::Mat sobelfft = FFT::FFT2D<Vec2d>(sobelPadded, -1);
-    logMag = Util::Magnitude<double>(fft, 20.0, true);
+    cv::Mat mag, logMag;
+    cv::Mat sobel = Filter::Sobel();
+    sobel = sobel.t();
+
+    // image padded for linear convolution, the Sobel spectrum for that
+    //         size comes from the kernel cache after the first frame
+    cv::Size size(image.source.cols + sobel.cols - 1, image.source.rows + sobel.rows - 1);
+    Spectrum fft = FFT::Forward<T>(image.source, true, size);
+    Spectrum sobelfft = FFT::KernelSpectrum(sobel, fft.rows, fft.cols, fft.shifted);
+    logMag = Util::Magnitude(fft, 20.0, true);
     imshow("FFT Lenna", logMag);
-    logMag = Util::Magnitude<double>(sobelfft, 20.0, true);
+    logMag = Util::Magnitude(sobelfft, 20.0, true);
     imshow("FFT Sobel", logMag);
     
-    Util::Shift<Vec2d>(sobelfft);
-    cv::split(sobelfft, sobelchannels);
-    cv::split(fft, channels);
-    cv::Mat re = channels[0].mul(sobelchannels[0]);
-    re = re - channels[1].mul(sobelchannels[1]);
-    cv::Mat im = channels[0].mul(sobelchannels[1]);
-    im = im + channels[1].mul(sobelchannels[0]);
-    channels[0] = re.clone();
-    channels[1] = im.clone();
-    cv::merge(channels, fft);
-    logMag = Util::Magnitude<Vec2d>(fft, 20.0, true);
-    cv::split(logMag, channels);
-    imshow("test", channels[0]);
+    FFT::Multiply(fft, sobelfft);
+    logMag = Util::Magnitude(fft, 20.0, true);
+    imshow("test", logMag);
     
     sout << "img/fft2/lennaedge.png";
     cout << "Writing image to " << sout.str() << endl;
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
+    Spectrum invfft = FFT::Inverse(fft);
 
-    cv::split(invfft, channels);
-    cv::Mat img = channels[0](cv::Rect(128, 128, 256, 256));
-    Util::Normalize<double>(img, cv::Scalar(255.0), 0);
-    img.convertTo(img, CV_8UC1);
+    cv::Mat img;
+    Util::NormalizeTo8U<double>(invfft.re(cv::Rect(0, 0, image.source.cols, image.source.rows)), img, 0.0, 255.0);
     imshow("InvFFT", img);
 
     imwrite(sout.str().c_str(), logMag);
@@ -207,31 +172,59 @@ template< class T >
 int experiment3(Image<T> &image, const char* outfile)
 {
     ostringstream sout;
-    cv::Mat mag, logMag;
-    vector<cv::Mat> channels(2);
 
-    cv::Mat fft = FFT::FFT2D<T>(image.source, -1);
+    Spectrum fft = FFT::Forward<T>(image.source);
 
-    Noise::Create<Vec2d>(fft, h, 0.1, 0.1, 1);
+    cv::Mat H = Restore::Transfer(BLUR_MOTION, 0.1, 0.1, 1.0, fft.rows, fft.cols);
+    Restore::Degrade(fft, H);
    
     sout << "img/fft2/lennamotion.png";
     cout << "Writing image to " << sout.str() << endl;
 
-    cv::Mat invfft = FFT::FFT2D<Vec2d>(fft, 1);
+    Spectrum invfft = FFT::Inverse(fft);
 
-    cv::split(invfft, channels);
-    cv::Mat img = channels[0];
-    Util::Normalize<double>(img, cv::Scalar(255.0), 0);
-    img.convertTo(img, CV_8UC1);
+    cv::Mat img;
+    Util::NormalizeTo8U<double>(invfft.re, img, 0.0, 255.0);
     imshow("Lenna MotionBlur", img);
 
-    imwrite(sout.str().c_str(), logMag);
+    imwrite(sout.str().c_str(), img);
+    sout.str("");
+
+    Restore::Apply(fft, H, RESTORE_WIENER, 0.001);
+
+    sout << "img/fft2/lennarestored.png";
+    cout << "Writing image to " << sout.str() << endl;
+
+    invfft = FFT::Inverse(fft);
+
+    Util::NormalizeTo8U<double>(invfft.re, img, 0.0, 255.0);
+    imshow("Lenna Restored", img);
+
+    imwrite(sout.str().c_str(), img);
     sout.str("");
  
     return 0;
 }
 
 
+template< class T >
+int experiment4(Image<T> &image, const char* outfile)
+{
+    // frames are crops of the image moved by known offsets, all registered
+    //         against the first crop with its spectrum computed once
+    const int border = 16;
+    cv::Rect window(border, border, image.source.cols - 2*border, image.source.rows - 2*border);
+    Register::Reference<T> reference(image.source(window), true);
+
+    int offsets[4][2] = {{3, -2}, {-7, 5}, {12, 9}, {-15, -11}};
+    vector<cv::Mat> frames;
+    for( int k=0; k<4; k++ )
+        frames.push_back(image.source(cv::Rect(border - offsets[k][0], border - offsets[k][1], window.width, window.height)));
+
+    vector<Register::Translation> found = reference.Correlate(frames);
+    for( size_t k=0; k<found.size(); k++ )
+        cout << "Offset (" << offsets[k][0] << ", " << offsets[k][1] << ") found ("
+            << found[k].x << ", " << found[k].y << ") response " << found[k].response << endl;
 
-
-
+    return 0;
+}